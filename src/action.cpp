@@ -20,11 +20,73 @@
 
 #include "action.hpp"
 
+#include <algorithm>
 #include <cstdlib>
-#include <iostream>
-#include <ostream>
+#include <cwctype>
 #include <string>
 
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "output.hpp"
+#include "unicode.hpp"
+
+namespace
+{
+
+/// Write an unsigned integer in little-endian order.
+/// @param out where to write
+/// @param n the integer
+/// @param bytes the number of bytes to write
+void write_le(output_buffer& out, unsigned long long n, int bytes)
+{
+  for (int i = 0; i != bytes; ++i, n >>= 8)
+    out.put(static_cast<char>(n & 0xff));
+}
+
+/// Write a string with a 4-byte length prefix.
+void write_binary(output_buffer& out, std::string const& str)
+{
+  write_le(out, str.size(), 4);
+  out.write(str);
+}
+
+__thread long match_total; ///< the number of matches in the file, for count_matches
+
+typedef boost::unordered_map<std::string, unsigned long> tally; ///< how often each key was seen, for aggregate
+__thread tally* thread_tally = 0; ///< the calling thread's tally, or null before its first match
+std::vector<tally*> tallies;      ///< the tally of every thread, for aggregate::finish_all
+boost::mutex tallies_mutex;       ///< protects @c tallies
+
+/// @return the calling thread's tally, which is created at the first call
+tally& local_tally()
+{
+  if (thread_tally == 0)
+  {
+    thread_tally = new tally;
+    boost::mutex::scoped_lock lock(tallies_mutex);
+    tallies.push_back(thread_tally);
+  }
+  return *thread_tally;
+}
+
+/// Order tally entries by descending count, and equal counts by key.
+bool more_often(tally::value_type const* a, tally::value_type const* b)
+{
+  return a->second != b->second ? a->second > b->second : a->first < b->first;
+}
+
+/// Fold a UTF-8 string to lower case, one code point at a time.
+std::string fold_case(char const* text, std::size_t size)
+{
+  std::wstring wide(utf8_to_utf32(text, size));
+  for (std::wstring::iterator c = wide.begin(); c != wide.end(); ++c)
+    *c = std::towlower(*c);
+  return utf32_to_utf8(wide);
+}
+
+} // end of namespace
+
 void action::finish_file(std::string const&, long)
 {}
 
@@ -34,6 +96,22 @@ void action::finish_all()
 void action::initialize()
 {}
 
+bool action::perform(std::string const& text, std::string const& filename, match_position const&)
+{
+  return perform(text, filename);
+}
+
+bool action::positions() const
+{
+  return false;
+}
+
+void action::context(std::string const&, std::string const&)
+{}
+
+void action::separate()
+{}
+
 
 bool count::perform(std::string const&, std::string const&)
 {
@@ -42,28 +120,276 @@ bool count::perform(std::string const&, std::string const&)
 
 void count::finish_file(std::string const& filename, long count)
 {
+  output_buffer& out = output_buffer::current();
   if (not filename.empty())
-    std::cout << filename << ": ";
-  std::cout << count << '\n';
+  {
+    out.write(filename);
+    out.write(": ", 2);
+  }
+  out.write_number(count);
+  out.end_line();
+}
+
+
+void count_matches::initialize()
+{
+  match_total = 0;
+}
+
+bool count_matches::perform(std::string const&, std::string const&, match_position const& position)
+{
+  match_total += (position.spans.empty() ? 1 : position.spans.size());
+  return true;
+}
+
+bool count_matches::positions() const
+{
+  return true;
+}
+
+void count_matches::finish_file(std::string const& filename, long)
+{
+  count::finish_file(filename, match_total);
 }
 
 
 bool echo_text::perform(std::string const& text, std::string const& filename)
 {
+  output_buffer& out = output_buffer::current();
+  if (not filename.empty())
+  {
+    out.write(filename);
+    out.write(": ", 2);
+  }
+  out.write(text);
+  out.end_line();
+  return true;
+}
+
+void echo_text::context(std::string const& text, std::string const& filename)
+{
+  output_buffer& out = output_buffer::current();
   if (not filename.empty())
-    std::cout << filename << ": ";
-  std::cout << text << '\n';
+  {
+    out.write(filename);
+    out.write("- ", 2);
+  }
+  out.write(text);
+  out.end_line();
+}
+
+void echo_text::separate()
+{
+  output_buffer& out = output_buffer::current();
+  out.write("--", 2);
+  out.end_line();
+}
+
+
+bool only_matching::perform(std::string const&, std::string const&)
+{
+  return true;
+}
+
+bool only_matching::perform(std::string const& text, std::string const& filename, match_position const& position)
+{
+  output_buffer& out = output_buffer::current();
+  for (std::vector<std::pair<std::size_t, std::size_t> >::const_iterator s = position.spans.begin();
+       s != position.spans.end(); ++s)
+  {
+    if (s->first == s->second)
+      continue;
+    if (not filename.empty())
+    {
+      out.write(filename);
+      out.write(": ", 2);
+    }
+    out.write(text.data() + s->first, s->second - s->first);
+    out.end_line();
+  }
+  return true;
+}
+
+bool only_matching::positions() const
+{
   return true;
 }
 
 
 bool echo_file::perform(std::string const& text, std::string const& filename)
 {
-  std::cout << filename << '\n';
+  output_buffer& out = output_buffer::current();
+  out.write(filename);
+  out.end_line();
   return false;
 }
 
 
+bool json_records::perform(std::string const&, std::string const&)
+{
+  return true;
+}
+
+bool json_records::perform(std::string const& text, std::string const&, match_position const& position)
+{
+  output_buffer& out = output_buffer::current();
+  out.write("{\"document\":", 12);
+  out.write_json(position.document);
+  out.write(",\"stream\":", 10);
+  out.write_json(position.stream);
+  out.write(",\"location\":", 12);
+  out.write_json(position.location);
+  out.write(",\"paragraph\":", 13);
+  out.write_number(position.paragraph);
+  out.write(",\"text\":", 8);
+  out.write_json(text);
+  out.write(",\"matches\":[", 12);
+  for (std::vector<std::pair<std::size_t, std::size_t> >::const_iterator s = position.spans.begin();
+       s != position.spans.end(); ++s)
+  {
+    if (s != position.spans.begin())
+      out.put(',');
+    out.put('[');
+    out.write_number(s->first);
+    out.put(',');
+    out.write_number(s->second);
+    out.put(']');
+  }
+  out.write("]}", 2);
+  out.end_line();
+  return true;
+}
+
+bool json_records::positions() const
+{
+  return true;
+}
+
+
+bool binary_records::perform(std::string const&, std::string const&)
+{
+  return true;
+}
+
+bool binary_records::perform(std::string const& text, std::string const&, match_position const& position)
+{
+  output_buffer& out = output_buffer::current();
+  std::size_t const size = 4 + position.document.size() + 4 + position.stream.size() +
+                           4 + position.location.size() + 8 + 4 + text.size() +
+                           4 + 16 * position.spans.size();
+  write_le(out, size, 4);
+  write_binary(out, position.document);
+  write_binary(out, position.stream);
+  write_binary(out, position.location);
+  write_le(out, position.paragraph, 8);
+  write_binary(out, text);
+  write_le(out, position.spans.size(), 4);
+  for (std::vector<std::pair<std::size_t, std::size_t> >::const_iterator s = position.spans.begin();
+       s != position.spans.end(); ++s)
+  {
+    write_le(out, s->first, 8);
+    write_le(out, s->second, 8);
+  }
+  return true;
+}
+
+bool binary_records::positions() const
+{
+  return true;
+}
+
+
+aggregate::aggregate(kind what)
+: kind_(what), fold_(false), top_(0)
+{}
+
+void aggregate::prepare(bool fold, std::size_t top, std::vector<std::string> const& names,
+                        std::vector<boost::wregex> const& patterns)
+{
+  fold_ = fold;
+  top_ = top;
+  names_ = names;
+  patterns_ = patterns;
+}
+
+bool aggregate::perform(std::string const& text, std::string const&)
+{
+  tally& counts = local_tally();
+  std::wstring const wide(utf8_to_utf32(text));
+  typedef boost::regex_iterator<std::wstring::const_iterator> match_iterator;
+  for (std::vector<boost::wregex>::size_type i = 0; i != patterns_.size(); ++i)
+  {
+    unsigned long n = 0;
+    for (match_iterator m(wide.begin(), wide.end(), patterns_[i]), end; m != end; ++m)
+      if (m->length() != 0)
+        ++n;
+    if (n != 0)
+      counts[names_[i]] += n;
+  }
+  return true;
+}
+
+bool aggregate::perform(std::string const& text, std::string const&, match_position const& position)
+{
+  tally& counts = local_tally();
+  if (kind_ == by_document)
+    counts[position.document] += (position.spans.empty() ? 1 : position.spans.size());
+  else
+    for (std::vector<std::pair<std::size_t, std::size_t> >::const_iterator s = position.spans.begin();
+         s != position.spans.end(); ++s)
+      if (s->first != s->second)
+      {
+        if (fold_)
+          ++counts[fold_case(text.data() + s->first, s->second - s->first)];
+        else
+          ++counts[text.substr(s->first, s->second - s->first)];
+      }
+  return true;
+}
+
+bool aggregate::positions() const
+{
+  return kind_ != by_pattern;
+}
+
+void aggregate::finish_all()
+{
+  tally total;
+  {
+    boost::mutex::scoped_lock lock(tallies_mutex);
+    for (std::vector<tally*>::iterator t = tallies.begin(); t != tallies.end(); ++t)
+    {
+      for (tally::const_iterator e = (*t)->begin(); e != (*t)->end(); ++e)
+        total[e->first] += e->second;
+      delete *t;
+    }
+    tallies.clear();
+    thread_tally = 0;
+  }
+
+  std::vector<tally::value_type const*> entries;
+  entries.reserve(total.size());
+  for (tally::const_iterator e = total.begin(); e != total.end(); ++e)
+    entries.push_back(&*e);
+  std::size_t const count = (top_ == 0 ? entries.size() : std::min(top_, entries.size()));
+  std::partial_sort(entries.begin(), entries.begin() + count, entries.end(), more_often);
+
+  // The counts are right-aligned, as uniq -c prints them.
+  output_buffer& out = output_buffer::current();
+  for (std::size_t i = 0; i != count; ++i)
+  {
+    unsigned long const n = entries[i]->second;
+    for (unsigned long width = 10; width <= 1000000; width *= 10)
+      if (n < width)
+        out.put(' ');
+    out.write_number(n);
+    out.put(' ');
+    out.write(entries[i]->first);
+    out.end_line();
+  }
+}
+
+
 bool echo_nomatch::perform(std::string const&, std::string const&)
 {
   return false;
@@ -72,7 +398,11 @@ bool echo_nomatch::perform(std::string const&, std::string const&)
 void echo_nomatch::finish_file(std::string const& filename, long count)
 {
   if (count == 0)
-    std::cout << filename << '\n';
+  {
+    output_buffer& out = output_buffer::current();
+    out.write(filename);
+    out.end_line();
+  }
 }
 
 
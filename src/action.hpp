@@ -22,11 +22,31 @@
 #ifndef ACTION_HPP
 #define ACTION_HPP
 
+#include <cstddef>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/regex.hpp>
+
+/** Where a match was found, for the actions that print structured records.
+ */
+struct match_position
+{
+  match_position() : paragraph(0) {}
+  std::string document;     ///< the document, as named on the command line or in a bundle
+  std::string stream;       ///< the stream in the package, such as content.xml, or empty for a flat document
+  std::string location;     ///< the position of the paragraph, such as a spreadsheet cell, or empty
+  unsigned long paragraph;  ///< the index of the paragraph in the stream, counting from 0
+  /// The UTF-8 byte offsets of the start and end of each match in the paragraph
+  std::vector<std::pair<std::size_t, std::size_t> > spans;
+};
 
 /** Abstract base class for all actions.
  * An action is invoked for each match. The action does whatever the user
  * requested. The command line options determine which action to invoke.
+ * Actions print to output_buffer::current(), which is the standard output
+ * unless the calling thread redirected it.
  */
 struct action
 {
@@ -39,6 +59,30 @@ struct action
    * @return true to continue looking for matches, false to stop reading this file
    */
   virtual bool perform(std::string const& text, std::string const& filename) = 0;
+  /** Invoke the action, with the position of the match.
+   * This is called instead of perform(text, filename) if positions()
+   * returns true. Default is to ignore the position.
+   * @param text the paragraph that matched
+   * @param filename the name of the file that matched
+   * @param position where the match was found
+   * @return true to continue looking for matches, false to stop reading this file
+   */
+  virtual bool perform(std::string const& text, std::string const& filename, match_position const& position);
+  /** Tell whether the action needs the position of each match.
+   * Finding the position costs a second pass over the paragraph, so
+   * it is done only for actions that ask for it. Default is false.
+   */
+  virtual bool positions() const;
+  /** Print a paragraph that did not match but is near a match, for -A, -B, and -C.
+   * Default is to do nothing.
+   * @param text the paragraph
+   * @param filename the name of the file that holds the paragraph
+   */
+  virtual void context(std::string const& text, std::string const& filename);
+  /** Print the separator between groups of paragraphs that are not next
+   * to each other, for -A, -B, and -C. Default is to do nothing.
+   */
+  virtual void separate();
   /** Perform any required clean-up actions after searching a single file.
    * Default is to do nothing.
    * @param filename The name of the file that was just finished
@@ -61,11 +105,44 @@ struct count : action
   virtual void finish_file(std::string const& filename, long count);
 };
 
+/** Print a count of every match in a file, not just the paragraphs that
+ * match, for --count-matches. With --invert-match, a paragraph counts once.
+ */
+struct count_matches : count
+{
+  /** Reset the count. */
+  virtual void initialize();
+  using count::perform;
+  /** Add the matches in the paragraph to the count. */
+  virtual bool perform(std::string const& text, std::string const& filename, match_position const& position);
+  /** Return true. */
+  virtual bool positions() const;
+  /** Print the count of matches instead of the count of paragraphs. */
+  virtual void finish_file(std::string const& filename, long count);
+};
+
 /** Echo the matching text.
  */
 struct echo_text : action
 {
   virtual bool perform(std::string const& text, std::string const& filename);
+  /** Echo the paragraph, with a hyphen after the file name instead of a colon. */
+  virtual void context(std::string const& text, std::string const& filename);
+  /** Print "--" on a line of its own. */
+  virtual void separate();
+};
+
+/** Echo only the part of the text that matches, one match per line, for -o.
+ * Empty matches are not printed.
+ */
+struct only_matching : action
+{
+  /** Do nothing; the position is needed. */
+  virtual bool perform(std::string const& text, std::string const& filename);
+  /** Print each match. */
+  virtual bool perform(std::string const& text, std::string const& filename, match_position const& position);
+  /** Return true. */
+  virtual bool positions() const;
 };
 
 /** Echo only the file name.
@@ -85,6 +162,78 @@ struct echo_nomatch : action
   virtual void finish_file(std::string const& filename, long count);
 };
 
+/** Print each match as a JSON object on a line of its own (NDJSON).
+ * The object has the members document, stream, location, paragraph,
+ * text, and matches, which is an array of [start, end] UTF-8 byte
+ * offsets into text.
+ */
+struct json_records : action
+{
+  /** Do nothing; the position is needed. */
+  virtual bool perform(std::string const& text, std::string const& filename);
+  /** Print the record. */
+  virtual bool perform(std::string const& text, std::string const& filename, match_position const& position);
+  /** Return true. */
+  virtual bool positions() const;
+};
+
+/** Print each match as a length-prefixed binary record.
+ * All integers are unsigned and little-endian. A record is a 4-byte
+ * length of the rest of the record, followed by the document, stream,
+ * and location as strings, the paragraph index in 8 bytes, the text as
+ * a string, a 4-byte count of matches, and the start and end of each
+ * match in 8 bytes each. A string is a 4-byte length and that many
+ * bytes of UTF-8.
+ */
+struct binary_records : action
+{
+  /** Do nothing; the position is needed. */
+  virtual bool perform(std::string const& text, std::string const& filename);
+  /** Print the record. */
+  virtual bool perform(std::string const& text, std::string const& filename, match_position const& position);
+  /** Return true. */
+  virtual bool positions() const;
+};
+
+/** Count the matches in all the documents, and print the keys that
+ * were seen most often, for --aggregate. Each thread counts in a hash
+ * table of its own, so only the counts are shared, and the tables are
+ * merged once, by finish_all().
+ */
+struct aggregate : action
+{
+  /// What to count
+  enum kind {
+    by_match,    ///< each distinct string that matched
+    by_document, ///< the matches in each document
+    by_pattern   ///< the matches of each pattern, one per line of the pattern
+  };
+  /// @param what what to count
+  aggregate(kind what);
+  /** Set the options that are known only after the command line is parsed.
+   * @param fold true to count matched strings without regard to case
+   * @param top the number of keys to print, or 0 for all of them
+   * @param names the text of each pattern, for by_pattern
+   * @param patterns the compiled patterns, for by_pattern
+   */
+  void prepare(bool fold, std::size_t top, std::vector<std::string> const& names,
+               std::vector<boost::wregex> const& patterns);
+  /** Count the matches of each pattern, for by_pattern. */
+  virtual bool perform(std::string const& text, std::string const& filename);
+  /** Count the matches, for by_match and by_document. */
+  virtual bool perform(std::string const& text, std::string const& filename, match_position const& position);
+  /** Return true, except for by_pattern. */
+  virtual bool positions() const;
+  /** Merge the counts and print the report. */
+  virtual void finish_all();
+private:
+  kind kind_;                           ///< what to count
+  bool fold_;                           ///< true to fold matched strings to lower case
+  std::size_t top_;                     ///< the number of keys to print, or 0 for all
+  std::vector<std::string> names_;      ///< the text of each pattern
+  std::vector<boost::wregex> patterns_; ///< each pattern
+};
+
 /** Exit successfully without printing anything.
  */
 struct quiet : action
@@ -0,0 +1,323 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/// @file arena.cpp
+/// Implement the arena allocator and the libxml2 memory hooks.
+
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <boost/thread/mutex.hpp>
+
+extern "C"
+{
+#include <libxml/xmlerror.h>
+#include <libxml/xmlmemory.h>
+}
+
+namespace
+{
+
+/// Every block is aligned to this many bytes, which is enough for any type.
+std::size_t const alignment = 16;
+/// Keep at most this many ordinary chunks when an arena is reset.
+std::size_t const retained_chunks = 8;
+
+/// Round @p size up to a multiple of the alignment.
+inline std::size_t align(std::size_t size)
+{
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/// The hooks put a header in front of every block so free and realloc
+/// can tell arena blocks from heap blocks and know the size of the old block.
+struct header
+{
+  std::size_t size; ///< size that the caller requested
+  arena* owner;     ///< the arena that owns the block, or null for malloc
+};
+
+/// The header is padded so that the caller's block stays aligned.
+std::size_t const header_size = (sizeof(header) + alignment - 1) & ~(alignment - 1);
+
+bool hooks_installed = false;              ///< true after arena::install()
+__thread arena* current_arena = 0;         ///< the calling thread's current arena
+__thread arena::counters local_counters;   ///< the calling thread's counters, not yet folded into @c global_counters
+arena::counters global_counters;           ///< counters from all threads
+boost::mutex counters_mutex;               ///< protects @c global_counters
+
+/// Add the calling thread's counters to the global counters and clear them.
+void fold_counters()
+{
+  boost::mutex::scoped_lock lock(counters_mutex);
+  global_counters.allocations      += local_counters.allocations;
+  global_counters.bytes            += local_counters.bytes;
+  global_counters.heap_allocations += local_counters.heap_allocations;
+  global_counters.heap_bytes       += local_counters.heap_bytes;
+  global_counters.frees            += local_counters.frees;
+  global_counters.skipped_frees    += local_counters.skipped_frees;
+  global_counters.chunks           += local_counters.chunks;
+  global_counters.resets           += local_counters.resets;
+  std::memset(&local_counters, 0, sizeof(local_counters));
+}
+
+/// Return the header of a block that was allocated by the hooks.
+inline header* header_of(void* block)
+{
+  return reinterpret_cast<header*>(static_cast<char*>(block) - header_size);
+}
+
+/// Return the caller's part of a block, after the header.
+inline void* block_of(header* h)
+{
+  return reinterpret_cast<char*>(h) + header_size;
+}
+
+} // end of namespace
+
+/// The libxml2 memory functions. These are static members of a friend
+/// so they can grow arena blocks in place.
+struct arena_hooks
+{
+  static void* malloc(std::size_t size)
+  {
+    header* h;
+    if (current_arena != 0)
+    {
+      try
+      {
+        h = static_cast<header*>(current_arena->allocate(header_size + size));
+      }
+      catch (std::bad_alloc const&)
+      {
+        return 0;
+      }
+    }
+    else
+    {
+      h = static_cast<header*>(std::malloc(header_size + size));
+      if (h == 0)
+        return 0;
+      ++local_counters.heap_allocations;
+      local_counters.heap_bytes += size;
+    }
+    h->size = size;
+    h->owner = current_arena;
+    return block_of(h);
+  }
+
+  static void free(void* block)
+  {
+    if (block == 0)
+      return;
+    header* h = header_of(block);
+    if (h->owner != 0)
+      ++local_counters.skipped_frees;
+    else
+    {
+      ++local_counters.frees;
+      std::free(h);
+    }
+  }
+
+  static void* realloc(void* block, std::size_t size)
+  {
+    if (block == 0)
+      return malloc(size);
+    header* h = header_of(block);
+    if (h->owner == 0)
+    {
+      // Heap blocks stay on the heap, even inside a scope.
+      h = static_cast<header*>(std::realloc(h, header_size + size));
+      if (h == 0)
+        return 0;
+      h->size = size;
+      return block_of(h);
+    }
+    if (h->owner == current_arena and current_arena->grow(h, header_size + size))
+    {
+      h->size = size;
+      return block;
+    }
+    void* result = malloc(size);
+    if (result != 0)
+      std::memcpy(result, block, std::min(h->size, size));
+    return result;
+  }
+
+  static char* strdup(char const* str)
+  {
+    std::size_t size = std::strlen(str) + 1;
+    char* result = static_cast<char*>(malloc(size));
+    if (result != 0)
+      std::memcpy(result, str, size);
+    return result;
+  }
+};
+
+
+arena::arena(std::size_t chunk_size)
+: chunk_size_(chunk_size), index_(0), next_(0), limit_(0), last_(0),
+  scratch_(0), scratch_size_(0)
+{}
+
+arena::~arena()
+{
+  for (std::vector<chunk>::iterator c = chunks_.begin(); c != chunks_.end(); ++c)
+    std::free(c->memory);
+}
+
+void* arena::allocate(std::size_t size)
+{
+  size = align(size);
+  if (size > static_cast<std::size_t>(limit_ - next_))
+    next_chunk(size);
+  last_ = next_;
+  next_ += size;
+  ++local_counters.allocations;
+  local_counters.bytes += size;
+  return last_;
+}
+
+void* arena::scratch(std::size_t size)
+{
+  if (size > scratch_size_)
+  {
+    // Double the block, so a run of ever larger callers costs at most twice the largest.
+    std::size_t const new_size = std::max(size, 2 * scratch_size_);
+    scratch_ = allocate(new_size);
+    scratch_size_ = new_size;
+  }
+  return scratch_;
+}
+
+bool arena::grow(void* block, std::size_t size)
+{
+  char* start = static_cast<char*>(block);
+  if (start != last_ or align(size) > static_cast<std::size_t>(limit_ - start))
+    return false;
+  local_counters.bytes += start + align(size) - next_;
+  next_ = start + align(size);
+  return true;
+}
+
+void arena::next_chunk(std::size_t size)
+{
+  // Chunks that are too small for an oversized block are skipped,
+  // and sit idle until the next reset.
+  std::size_t i = (limit_ == 0 ? 0 : index_ + 1);
+  while (i < chunks_.size() and chunks_[i].size < size)
+    ++i;
+  if (i == chunks_.size())
+  {
+    chunk c;
+    c.size = std::max(chunk_size_, size);
+    c.memory = static_cast<char*>(std::malloc(c.size));
+    if (c.memory == 0)
+      throw std::bad_alloc();
+    chunks_.push_back(c);
+    ++local_counters.chunks;
+  }
+  index_ = i;
+  next_ = chunks_[i].memory;
+  limit_ = next_ + chunks_[i].size;
+}
+
+void arena::reset()
+{
+  std::size_t kept = 0;
+  for (std::vector<chunk>::iterator c = chunks_.begin(); c != chunks_.end(); ++c)
+    if (c->size == chunk_size_ and kept < retained_chunks)
+      chunks_[kept++] = *c;
+    else
+      std::free(c->memory);
+  chunks_.resize(kept);
+  index_ = 0;
+  next_ = limit_ = last_ = 0;
+  scratch_ = 0;
+  scratch_size_ = 0;
+  ++local_counters.resets;
+}
+
+void arena::install()
+{
+  xmlMemSetup(arena_hooks::free, arena_hooks::malloc, arena_hooks::realloc, arena_hooks::strdup);
+  hooks_installed = true;
+}
+
+bool arena::installed()
+{
+  return hooks_installed;
+}
+
+arena* arena::current()
+{
+  return current_arena;
+}
+
+void arena::fold()
+{
+  fold_counters();
+}
+
+arena::counters arena::totals()
+{
+  fold_counters();
+  boost::mutex::scoped_lock lock(counters_mutex);
+  return global_counters;
+}
+
+
+arena::scope::scope(arena& a)
+: arena_(a), previous_(current_arena)
+{
+  // libxml2 creates the thread's global state, which holds the last error,
+  // on first use. Make sure that happens on the heap, not in the arena.
+  xmlGetLastError();
+  current_arena = &arena_;
+}
+
+arena::scope::~scope()
+{
+  // The last error outlives the document, but libxml2 copied its message
+  // and file name into the arena. Free them while the arena is still
+  // current, so a later xmlResetLastError or xmlCleanupParser does not
+  // free memory that the next document has reused.
+  xmlResetLastError();
+  current_arena = previous_;
+  arena_.reset();
+  fold_counters();
+}
+
+
+arena::suspend::suspend()
+: previous_(current_arena)
+{
+  current_arena = 0;
+}
+
+arena::suspend::~suspend()
+{
+  current_arena = previous_;
+}
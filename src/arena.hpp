@@ -0,0 +1,188 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file arena.hpp
+ * Per-document bump allocation.
+ * libxml2 allocates a node, a name, and a text buffer for nearly everything
+ * it parses, and xmlFreeDoc must visit every one of them again to free them.
+ * An arena hands out memory by bumping a pointer and releases all of it
+ * in a single reset after the document has been searched.
+ */
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <vector>
+
+/** Bump allocator for the lifetime of one document.
+ * Memory is carved out of large chunks that are obtained from malloc.
+ * Individual blocks are never freed; reset() makes all chunks available
+ * again at once.
+ *
+ * libxml2 is routed through the arena by install(), which replaces libxml2's
+ * allocation functions. While an arena::scope is alive on a thread, every
+ * libxml2 allocation on that thread comes from the scope's arena. Outside
+ * a scope, the allocation functions fall through to malloc.
+ */
+class arena
+{
+public:
+  /// Allocation counters, summed over all threads.
+  struct counters
+  {
+    unsigned long allocations;      ///< blocks served from an arena
+    unsigned long bytes;            ///< bytes served from an arena
+    unsigned long heap_allocations; ///< blocks passed through to malloc by the libxml2 hooks
+    unsigned long heap_bytes;       ///< bytes passed through to malloc by the libxml2 hooks
+    unsigned long frees;            ///< calls to free that reached the C library
+    unsigned long skipped_frees;    ///< calls to free for arena memory, which cost nothing
+    unsigned long chunks;           ///< chunks obtained from malloc to back the arenas
+    unsigned long resets;           ///< arena resets, one per document
+  };
+
+  /// Default size of each chunk.
+  static std::size_t const default_chunk_size = 1024 * 1024;
+
+  /// Construct an empty arena. No memory is allocated until it is needed.
+  /// @param chunk_size the size of each chunk obtained from malloc
+  explicit arena(std::size_t chunk_size = default_chunk_size);
+  /// Release every chunk.
+  ~arena();
+
+  /// Allocate a block of memory. The block is suitably aligned for any type.
+  /// @param size the number of bytes to allocate
+  /// @returns a pointer to the new block; never returns a null pointer
+  /// @throw std::bad_alloc if no memory is available
+  void* allocate(std::size_t size);
+  /// Allocate an array.
+  /// @param n the number of elements in the array
+  /// @returns a pointer to uninitialized storage for @p n objects of type @p T
+  template<class T>
+  T* allocate_array(std::size_t n)
+  {
+    return static_cast<T*>(allocate(n * sizeof(T)));
+  }
+  /// Return a scratch block that is reused by every call until the next reset.
+  /// The block grows, by allocating a new one from the arena, only when a
+  /// caller needs more than any earlier caller, so a loop that needs a
+  /// buffer for each item uses memory in proportion to the largest item.
+  /// @param size the number of bytes that the caller needs
+  /// @returns a block of at least @p size bytes; its contents are unspecified
+  void* scratch(std::size_t size);
+  /// Return a scratch array, as scratch() does.
+  /// @param n the number of elements in the array
+  /// @returns a pointer to uninitialized storage for @p n objects of type @p T
+  template<class T>
+  T* scratch_array(std::size_t n)
+  {
+    return static_cast<T*>(scratch(n * sizeof(T)));
+  }
+  /// Make all memory available again. Pointers into the arena become invalid.
+  /// Oversized chunks are returned to malloc, and only a few ordinary
+  /// chunks are kept for reuse by the next document.
+  void reset();
+
+  /// Replace libxml2's memory functions with the arena-aware hooks.
+  /// Call this before any other libxml2 function, typically before
+  /// xmlInitParser. The hooks also count allocations even when no arena
+  /// is in use, which is how the --stats report compares the two modes.
+  static void install();
+  /// Test whether install() has been called.
+  static bool installed();
+  /// Return the calling thread's current arena.
+  /// @returns the arena of the innermost live scope, or a null pointer
+  static arena* current();
+  /// Return the allocation counters for the whole program.
+  /// The calling thread's counters are folded in first.
+  static counters totals();
+  /// Fold the calling thread's counters into the totals. A worker thread
+  /// that allocated outside any scope calls this before it exits.
+  static void fold();
+
+  /// Make an arena current for the calling thread. When the scope ends,
+  /// the previous arena (if any) becomes current again and the arena is reset.
+  /// libxml2's last error is cleared at the end of the scope, because its
+  /// strings were allocated from the arena.
+  class scope
+  {
+  public:
+    /// Make @p a the current arena.
+    /// @param a the arena that serves allocations until the scope ends
+    explicit scope(arena& a);
+    /// Restore the previous arena and reset this one.
+    ~scope();
+  private:
+    scope(scope const&);          ///< not implemented
+    void operator=(scope const&); ///< not implemented
+    arena& arena_;                ///< the arena that is current while the scope lives
+    arena* previous_;             ///< the arena that was current before the scope
+  };
+
+  /// Send libxml2's allocations on the calling thread to malloc while the
+  /// suspension lives, even inside a scope. Code that frees memory as it goes,
+  /// such as xmlTextReader, would otherwise fill the arena with blocks that
+  /// are never reused until the document ends.
+  class suspend
+  {
+  public:
+    /// Make no arena current.
+    suspend();
+    /// Make the previous arena current again.
+    ~suspend();
+  private:
+    suspend(suspend const&);        ///< not implemented
+    void operator=(suspend const&); ///< not implemented
+    arena* previous_;               ///< the arena that was current before the suspension
+  };
+
+private:
+  /// One block of memory obtained from malloc.
+  struct chunk
+  {
+    char* memory;     ///< start of the chunk
+    std::size_t size; ///< number of bytes in the chunk
+  };
+
+  arena(arena const&);          ///< not implemented
+  void operator=(arena const&); ///< not implemented
+
+  /// Move to the next chunk that can hold @p size bytes, allocating one if necessary.
+  /// @param size the size of the block that did not fit in the current chunk
+  void next_chunk(std::size_t size);
+  /// Try to grow the most recent block in place.
+  /// @param block the start of the block
+  /// @param size the new size of the block
+  /// @returns true if the block was the last one allocated and the chunk had room
+  bool grow(void* block, std::size_t size);
+
+  friend struct arena_hooks;
+
+  std::size_t const chunk_size_; ///< size of each ordinary chunk
+  std::vector<chunk> chunks_;    ///< all chunks, in the order they are used
+  std::size_t index_;            ///< index of the chunk that is being carved
+  char* next_;                   ///< first free byte in the current chunk
+  char* limit_;                  ///< one past the end of the current chunk
+  char* last_;                   ///< start of the most recent block, for grow()
+  void* scratch_;                ///< the block that scratch() returns, or null
+  std::size_t scratch_size_;     ///< number of bytes in @c scratch_
+};
+
+#endif
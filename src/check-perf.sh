@@ -0,0 +1,161 @@
+#!/bin/sh
+# Throughput regression check for odfgrep, run by "make check-perf".
+#
+# Usage: check-perf.sh ODFGREP ODFGEN BASELINE CORPUS
+#
+# Generate a fixed corpus with odfgen in the CORPUS directory, and search it
+# in several modes. For each mode, check that the output is the same as the
+# output of the sequential reference, one document at a time with the libxml2
+# tree extractor, and compare documents per second, megabytes per second, and
+# peak resident set size with the BASELINE file. Exit with status 1 if any
+# output differs or any mode is slower or bigger than the baseline allows.
+#
+# Environment:
+#   PERF_RUNS       timed runs of each mode, without --stats; the fastest counts (default 5)
+#   PERF_TOLERANCE  percent below the baseline throughput that still passes (default 30)
+#   PERF_RSS_TOLERANCE  percent above the baseline peak RSS that still passes (default 25)
+#   PERF_UPDATE     if not empty, write the measurements to BASELINE instead of checking them
+
+set -e
+
+if [ $# -ne 4 ]; then
+  echo "usage: $0 ODFGREP ODFGEN BASELINE CORPUS" >&2
+  exit 2
+fi
+# The searches run in the corpus, so the programs need absolute names.
+odfgrep=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+odfgen=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+baseline=$3
+corpus=$4
+runs=${PERF_RUNS:-5}
+tolerance=${PERF_TOLERANCE:-30}
+rss_tolerance=${PERF_RSS_TOLERANCE:-25}
+
+# The corpus and the pattern list must not change, or the baseline means nothing.
+rm -rf "$corpus"
+mkdir -p "$corpus"
+corpus=$(cd "$corpus" && pwd)
+"$odfgen" --seed=1 --documents=40 --paragraphs=2000 --length=12 --unicode=10 --depth=2 --changes=5 --repeat=4 "$corpus/docs"
+"$odfgen" --seed=2 --documents=4 --paragraphs=2000 --flat "$corpus/docs"
+awk 'BEGIN { for (i = 0; i < 300; ++i) printf "term%04d\n", i; print "budget"; print "AT&T"; print "\316\273\317\214\316\263\316\277\317\202" }' > "$corpus/strings"
+documents=$(ls "$corpus/docs" | wc -l)
+bytes=$(cat "$corpus"/docs/* | wc -c)
+
+# Each mode is a name, the options for both the mode and its reference,
+# the options for the mode alone, and the pattern, separated by colons.
+# STRINGS stands for the list of fixed strings, which -f reads instead of a pattern.
+modes='files-with-matches:-l::quarter
+count:-c::e[a-z]+
+ignore-case:-i -E -c::stra(ss|ß)e|caf[eé]|quarter[a-z]*
+fixed-strings:-o -F -f STRINGS::
+jobs:-E:-j 4:revenue|budget
+fast-extractor:-E:--extractor=fast:e[a-z]+t'
+
+# Print the value of a metric from a Prometheus report.
+metric() {
+  sed -n "s/^odfgrep_$1 //p" "$2"
+}
+
+measurements=$corpus/measurements
+: > "$measurements"
+rm -f "$measurements.failed"
+failed=0
+echo "$documents documents, $bytes bytes, best of $runs runs"
+printf '%-20s %10s %10s %12s\n' mode docs/s MB/s peak-RSS
+echo "$modes" | sed "s|STRINGS|$corpus/strings|" | while IFS=: read -r name common extra pattern; do
+  # The pattern is one argument, unless -f supplies the patterns.
+  set -f
+  if [ -n "$pattern" ]; then
+    set -- -- "$pattern"
+  else
+    set --
+  fi
+
+  # The sequential reference: one document at a time, with the libxml2 tree.
+  (cd "$corpus/docs" && set +f && "$odfgrep" --extractor=dom -j 1 $common "$@" *) > "$corpus/$name.expected" || true
+
+  # A run with --stats reports the peak RSS. The timed runs leave --stats
+  # off, so they measure odfgrep as it is used, without its stage timers.
+  # The clock is GNU date, in nanoseconds.
+  rm -f "$corpus/$name.stats"
+  (cd "$corpus/docs" && set +f && "$odfgrep" --stats=prometheus --stats-file="../$name.stats" $common $extra "$@" *) > /dev/null || true
+  if [ ! -s "$corpus/$name.stats" ]; then
+    echo "FAIL: $name: odfgrep did not write its statistics" >&2
+    echo "$name" >> "$measurements.failed"
+    set +f
+    continue
+  fi
+  rss=$(metric peak_rss_bytes "$corpus/$name.stats")
+
+  best=
+  run=0
+  while [ $run -lt "$runs" ]; do
+    start=$(date +%s%N)
+    (cd "$corpus/docs" && set +f && "$odfgrep" $common $extra "$@" *) > "$corpus/$name.out" || true
+    finish=$(date +%s%N)
+    if ! cmp -s "$corpus/$name.expected" "$corpus/$name.out"; then
+      echo "FAIL: $name: the output differs from the sequential reference" >&2
+      diff "$corpus/$name.expected" "$corpus/$name.out" | head -20 >&2
+      echo "$name" >> "$measurements.failed"
+      best=
+      break
+    fi
+    best=$(awk -v best="$best" -v e="$(( (finish - start) / 1000 ))" -v r="$rss" 'BEGIN { e /= 1e6; split(best, b, " "); if (best == "" || e < b[1] + 0) print e, r; else print best }')
+    run=$((run + 1))
+  done
+  set +f
+  [ -n "$best" ] || continue
+  echo "$name $best" | awk -v d="$documents" -v b="$bytes" \
+    '{ printf "%-20s %10.1f %10.2f %12d\n", $1, d / $2, b / $2 / 1e6, $3 }' | tee -a "$measurements"
+done
+
+if [ -f "$measurements.failed" ]; then
+  rm -f "$measurements.failed"
+  failed=1
+fi
+
+if [ -n "$PERF_UPDATE" ]; then
+  if [ $failed -ne 0 ]; then
+    echo "check-perf FAILED; $baseline is unchanged" >&2
+    exit 1
+  fi
+  {
+    echo "# Baseline for make check-perf: mode, documents per second, megabytes per second, peak RSS in bytes."
+    echo "# Regenerate it on the reference machine with: make perf-baseline"
+    cat "$measurements"
+  } > "$baseline"
+  echo "wrote $baseline"
+  exit 0
+fi
+
+if [ ! -f "$baseline" ]; then
+  echo "FAIL: no baseline in $baseline; run make perf-baseline" >&2
+  exit 1
+fi
+
+# Compare each mode with its baseline.
+if ! awk -v tolerance="$tolerance" -v rss_tolerance="$rss_tolerance" '
+  FILENAME == ARGV[1] { if ($1 !~ /^#/) { docs[$1] = $2; mb[$1] = $3; rss[$1] = $4 } next }
+  !($1 in docs) { print "FAIL: " $1 ": not in the baseline" > "/dev/stderr"; bad = 1; next }
+  {
+    low = 1 - tolerance / 100
+    high = 1 + rss_tolerance / 100
+    if ($2 < docs[$1] * low) {
+      printf "FAIL: %s: %.1f documents/s is more than %d%% below the baseline of %.1f\n", $1, $2, tolerance, docs[$1] > "/dev/stderr"; bad = 1
+    }
+    if ($3 < mb[$1] * low) {
+      printf "FAIL: %s: %.2f MB/s is more than %d%% below the baseline of %.2f\n", $1, $3, tolerance, mb[$1] > "/dev/stderr"; bad = 1
+    }
+    if ($4 > rss[$1] * high) {
+      printf "FAIL: %s: peak RSS of %d bytes is more than %d%% above the baseline of %d\n", $1, $4, rss_tolerance, rss[$1] > "/dev/stderr"; bad = 1
+    }
+  }
+  END { exit bad }' "$baseline" "$measurements"; then
+  failed=1
+fi
+
+if [ $failed -ne 0 ]; then
+  echo "check-perf FAILED" >&2
+  exit 1
+fi
+echo "check-perf passed"
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/// @file mapped_file.cpp
+/// Implement the mapped_file class.
+
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_file::error::error(std::string const& filename, int errnum)
+: std::runtime_error(filename + ": " + std::strerror(errnum))
+{}
+
+mapped_file::mapped_file(std::string const& filename)
+: data_(0), size_(0)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw error(filename, errno);
+  struct stat st;
+  if (::fstat(fd, &st) != 0)
+  {
+    int errnum = errno;
+    ::close(fd);
+    throw error(filename, errnum);
+  }
+  size_ = st.st_size;
+  if (size_ != 0)
+  {
+    void* p = ::mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+      int errnum = errno;
+      ::close(fd);
+      throw error(filename, errnum);
+    }
+    // The extractors read the file once, front to back.
+    ::madvise(p, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<char const*>(p);
+  }
+  ::close(fd);
+}
+
+mapped_file::~mapped_file()
+{
+  if (data_ != 0)
+    ::munmap(const_cast<char*>(data_), size_);
+}
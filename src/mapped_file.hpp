@@ -0,0 +1,66 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file mapped_file.hpp
+ * Read-only memory mapping of a whole file, so a document that is
+ * not a ZIP archive can be searched in place, without copying it.
+ */
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+/// A file that is mapped read-only into memory for as long as the object lives.
+class mapped_file
+{
+public:
+  /// Exception for a file that cannot be opened or mapped.
+  class error : public std::runtime_error
+  {
+  public:
+    /// Construct an exception object.
+    /// @param filename the file name, which prefixes the message
+    /// @param errnum the system error code
+    error(std::string const& filename, int errnum);
+  };
+
+  /// Map a file.
+  /// @param filename the path to the file
+  /// @throw error if the file cannot be opened or mapped
+  explicit mapped_file(std::string const& filename);
+  /// Unmap the file.
+  ~mapped_file();
+
+  /// @returns the first byte of the file, or null for an empty file
+  char const* data() const { return data_; }
+  /// @returns the number of bytes in the file
+  std::size_t size() const { return size_; }
+
+private:
+  mapped_file(mapped_file&);        ///< not implemented
+  void operator=(mapped_file&);     ///< not implemented
+  char const* data_;                ///< the mapping, or null
+  std::size_t size_;                ///< the size of the mapping
+};
+
+#endif
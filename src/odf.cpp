@@ -0,0 +1,845 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/// @file odf.cpp
+/// Implement the shared ODF vocabulary functions.
+
+#include "odf.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "xml.hpp"
+
+namespace odf
+{
+
+namespace
+{
+  /// A namespace URI and its identifier.
+  struct known_ns
+  {
+    char const* uri; ///< the namespace URI
+    ns id;           ///< the identifier for @c uri
+  };
+
+  known_ns const namespaces[] = {
+    { "urn:oasis:names:tc:opendocument:xmlns:office:1.0", office_ns },
+    { "urn:oasis:names:tc:opendocument:xmlns:text:1.0",   text_ns },
+    { "urn:oasis:names:tc:opendocument:xmlns:table:1.0",  table_ns },
+    { "urn:oasis:names:tc:opendocument:xmlns:drawing:1.0", draw_ns },
+    { "urn:oasis:names:tc:opendocument:xmlns:svg-compatible:1.0", svg_ns },
+    { "urn:oasis:names:tc:opendocument:xmlns:presentation:1.0", presentation_ns },
+  };
+
+  /// The namespace of META-INF/manifest.xml, which the extractors never see.
+  char const manifest_uri[] = "urn:oasis:names:tc:opendocument:xmlns:manifest:1.0";
+
+  /// The prefix of every ODF media type.
+  char const mimetype_prefix[] = "application/vnd.oasis.opendocument.";
+
+  /// A document type for --type and its media subtype.
+  struct type_name
+  {
+    char const* name;    ///< the name on the command line
+    char const* subtype; ///< the media type after @c mimetype_prefix
+  };
+  type_name const type_names[] = {
+    { "text",         "text" },
+    { "spreadsheet",  "spreadsheet" },
+    { "presentation", "presentation" },
+    { "drawing",      "graphics" },
+    { "chart",        "chart" },
+    { "formula",      "formula" },
+  };
+
+  /// Read a little-endian 16-bit number from a ZIP header.
+  inline unsigned get16(char const* p)
+  {
+    return static_cast<unsigned char>(p[0]) | static_cast<unsigned char>(p[1]) << 8;
+  }
+
+  /// The namespaces of the metadata fields, by their usual prefixes.
+  struct known_prefix
+  {
+    char const* prefix; ///< the prefix that the ODF standard uses
+    char const* uri;    ///< the namespace URI
+  };
+  known_prefix const meta_prefixes[] = {
+    { "dc",   "http://purl.org/dc/elements/1.1/" },
+    { "meta", "urn:oasis:names:tc:opendocument:xmlns:meta:1.0" },
+  };
+
+  /// An element that the extractors treat specially.
+  struct element_name
+  {
+    ns uri;                 ///< the element's namespace
+    char const* local_name; ///< the element's local name
+    element kind;           ///< what the element is
+  };
+
+  element_name const special[] = {
+    { office_ns, "meta",                 office_meta },
+    { office_ns, "body",                 office_body },
+    { office_ns, "text",                 office_text },
+    { office_ns, "spreadsheet",          office_spreadsheet },
+    { office_ns, "presentation",         office_presentation },
+    { office_ns, "drawing",              office_drawing },
+    { office_ns, "chart",                office_chart },
+    { office_ns, "master-styles",        office_master_styles },
+    { office_ns, "annotation",           office_annotation },
+    { office_ns, "binary-data",          no_paragraphs },
+    { office_ns, "forms",                no_paragraphs },
+    { text_ns,   "p",                    text_p },
+    { text_ns,   "h",                    text_h },
+    { text_ns,   "deletion",             text_deletion },
+    { text_ns,   "note-body",            text_note_body },
+    { text_ns,   "dde-connection-decls", no_paragraphs },
+    { text_ns,   "sequence-decls",       no_paragraphs },
+    { text_ns,   "user-field-decls",     no_paragraphs },
+    { text_ns,   "variable-decls",       no_paragraphs },
+    { table_ns,  "table",                table_table },
+    { table_ns,  "table-row",            table_row },
+    { table_ns,  "table-cell",           table_cell },
+    { table_ns,  "covered-table-cell",   table_cell },
+    { table_ns,  "calculation-settings", no_paragraphs },
+    { table_ns,  "content-validations",  no_paragraphs },
+    { table_ns,  "label-ranges",         no_paragraphs },
+    { draw_ns,   "frame",                draw_frame },
+    { draw_ns,   "enhanced-geometry",    no_paragraphs },
+    { draw_ns,   "page",                 draw_page },
+    { presentation_ns, "notes",          presentation_notes },
+    { svg_ns,    "title",                svg_title },
+    { svg_ns,    "desc",                 svg_desc },
+  };
+  std::size_t const special_count = sizeof(special) / sizeof(special[0]);
+
+  /// The names of the --scope values, indexed by bit number.
+  char const* const scope_names[] = { "headings", "tables", "notes", "annotations", "frames" };
+
+  /** An open-addressed hash table of the special local names.
+   * Few special names have the same length and first character,
+   * so with this hash, almost every lookup is a single probe.
+   */
+  class name_table
+  {
+  public:
+    name_table()
+    {
+      std::fill(slots_, slots_ + size, static_cast<element_name const*>(0));
+      for (std::size_t i = 0; i != special_count; ++i)
+      {
+        char const* name = special[i].local_name;
+        std::size_t h = hash(name, std::strlen(name));
+        while (slots_[h] != 0)
+          h = (h + 1) & (size - 1);
+        slots_[h] = &special[i];
+      }
+    }
+
+    element_name const* find(char const* name, std::size_t length)
+    const
+    {
+      for (std::size_t h = hash(name, length); slots_[h] != 0; h = (h + 1) & (size - 1))
+        if (std::strncmp(slots_[h]->local_name, name, length) == 0 and slots_[h]->local_name[length] == '\0')
+          return slots_[h];
+      return 0;
+    }
+
+  private:
+    static std::size_t const size = 64; ///< number of slots, a power of two
+    static std::size_t hash(char const* name, std::size_t length)
+    {
+      return (length * 37 + static_cast<unsigned char>(name[0])) & (size - 1);
+    }
+    element_name const* slots_[size]; ///< pointers into @c special
+  };
+
+  name_table const names;
+}
+
+ns namespace_of(char const* uri, std::size_t size)
+{
+  for (std::size_t i = 0; i != sizeof(namespaces) / sizeof(namespaces[0]); ++i)
+    if (std::strlen(namespaces[i].uri) == size and std::memcmp(namespaces[i].uri, uri, size) == 0)
+      return namespaces[i].id;
+  return other_ns;
+}
+
+char const* uri_of(ns id)
+{
+  for (std::size_t i = 0; i != sizeof(namespaces) / sizeof(namespaces[0]); ++i)
+    if (namespaces[i].id == id)
+      return namespaces[i].uri;
+  return "";
+}
+
+bool is_flat(char const* data, std::size_t size)
+{
+  char const* end = data + size;
+  // A UTF-16 document starts with a byte order mark, and a UTF-8 document may.
+  if (size >= 2 and ((data[0] == '\xfe' and data[1] == '\xff') or (data[0] == '\xff' and data[1] == '\xfe')))
+    return true;
+  if (size >= 3 and std::memcmp(data, "\xef\xbb\xbf", 3) == 0)
+    data += 3;
+  while (data != end and (*data == ' ' or *data == '\t' or *data == '\n' or *data == '\r'))
+    ++data;
+  return data != end and *data == '<';
+}
+
+std::string mimetype_of(char const* data, std::size_t size)
+{
+  // A ZIP local file header is 30 bytes, followed by the name and the extra field.
+  if (size >= 30 and std::memcmp(data, "PK\3\4", 4) == 0)
+  {
+    std::size_t const method = get16(data + 8);
+    std::size_t const length = get16(data + 18) | static_cast<std::size_t>(get16(data + 20)) << 16;
+    std::size_t const name_length = get16(data + 26);
+    std::size_t const start = 30 + name_length + get16(data + 28);
+    if (method != 0 or name_length != 8 or std::memcmp(data + 30, "mimetype", 8) != 0 or start + length > size)
+      return std::string();
+    return std::string(data + start, length);
+  }
+  if (not is_flat(data, size))
+    return std::string();
+  static char const attribute[] = ":mimetype=";
+  char const* end = data + size;
+  char const* p = std::search(data, end, attribute, attribute + sizeof(attribute) - 1);
+  if (p == end or end - p < static_cast<std::ptrdiff_t>(sizeof(attribute)))
+    return std::string();
+  p += sizeof(attribute) - 1;
+  char const* close = std::find(p + 1, end, *p);
+  if (close == end)
+    return std::string();
+  return std::string(p + 1, close);
+}
+
+bool parse_types(char const* list, std::vector<std::string>& result)
+{
+  result.clear();
+  while (*list != '\0')
+  {
+    std::size_t const size = std::strcspn(list, ",");
+    std::size_t i = 0;
+    while (i != sizeof(type_names) / sizeof(type_names[0]) and
+           (std::strncmp(type_names[i].name, list, size) != 0 or type_names[i].name[size] != '\0'))
+      ++i;
+    if (i == sizeof(type_names) / sizeof(type_names[0]))
+      return false;
+    result.push_back(type_names[i].subtype);
+    list += size;
+    if (*list == ',')
+      ++list;
+  }
+  return not result.empty();
+}
+
+bool is_odf(std::string const& mimetype)
+{
+  return mimetype.compare(0, sizeof(mimetype_prefix) - 1, mimetype_prefix) == 0;
+}
+
+bool is_type(std::string const& mimetype, std::vector<std::string> const& types)
+{
+  std::size_t const prefix = sizeof(mimetype_prefix) - 1;
+  if (mimetype.compare(0, prefix, mimetype_prefix) != 0)
+    return false;
+  for (std::vector<std::string>::const_iterator t = types.begin(); t != types.end(); ++t)
+    if (mimetype.compare(prefix, t->size(), *t) == 0 and
+        (mimetype.size() == prefix + t->size() or mimetype[prefix + t->size()] == '-'))
+      return true;
+  return false;
+}
+
+std::vector<manifest_entry> read_manifest(char const* text, std::size_t size)
+{
+  std::vector<manifest_entry> result;
+  xml::reader reader(text, size, "META-INF/manifest.xml", XML_PARSE_NONET);
+  if (not reader)
+    throw std::runtime_error("cannot read META-INF/manifest.xml");
+  xmlChar const* uri = reader.intern(manifest_uri);
+  xmlChar const* file_entry = reader.intern("file-entry");
+  xmlChar const* encryption_data = reader.intern("encryption-data");
+  int status;
+  while ((status = reader.read()) == 1)
+  {
+    if (reader.type() != xml::reader::element or reader.namespace_uri() != uri)
+      continue;
+    // Each <manifest:file-entry> is a child of the root, and
+    // <manifest:encryption-data> is a child of its file entry.
+    if (reader.depth() == 1 and reader.local_name() == file_entry)
+    {
+      manifest_entry entry;
+      reader.attribute("full-path", manifest_uri, entry.path);
+      reader.attribute("media-type", manifest_uri, entry.media_type);
+      entry.encrypted = false;
+      result.push_back(entry);
+    }
+    else if (reader.depth() == 2 and reader.local_name() == encryption_data and not result.empty())
+      result.back().encrypted = true;
+  }
+  if (status != 0)
+    throw std::runtime_error("cannot parse META-INF/manifest.xml");
+  return result;
+}
+
+std::vector<std::string> text_streams(std::vector<manifest_entry> const& manifest)
+{
+  static std::string const content("content.xml");
+  static std::string const styles("styles.xml");
+  bool has_content = false;
+  bool has_styles = false;
+  std::vector<std::string> result;
+  for (std::vector<manifest_entry>::const_iterator e = manifest.begin(); e != manifest.end(); ++e)
+  {
+    if (e->encrypted)
+      continue;
+    std::string::size_type slash = e->path.rfind('/');
+    std::string base(slash == std::string::npos ? e->path : e->path.substr(slash + 1));
+    if (e->path == content)
+      has_content = true;
+    else if (e->path == styles)
+      has_styles = true;
+    else if (base == content or base == styles)
+      result.push_back(e->path);
+  }
+  if (has_styles)
+    result.insert(result.begin(), styles);
+  if (has_content)
+    result.insert(result.begin(), content);
+  return result;
+}
+
+element lookup(char const* local_name, std::size_t size, ns& uri)
+{
+  if (size == 0)
+    return other_element;
+  element_name const* e = names.find(local_name, size);
+  if (e == 0)
+    return other_element;
+  uri = e->uri;
+  return e->kind;
+}
+
+
+vocabulary::vocabulary(xml::doc& doc)
+{
+  intern(doc);
+}
+
+vocabulary::vocabulary(xml::reader& reader)
+{
+  intern(reader);
+}
+
+template<class Dictionary>
+void vocabulary::intern(Dictionary& dict)
+{
+  entry const empty = { 0, other_element, other_ns };
+  std::fill(table_, table_ + slots, empty);
+  std::fill(uris_, uris_ + ns_count, static_cast<xmlChar const*>(0));
+  interned_ = (dict.intern("p") != 0);
+  if (not interned_)
+    return;
+  for (std::size_t i = 0; i != special_count; ++i)
+  {
+    xmlChar const* name = dict.intern(special[i].local_name);
+    entry& e = const_cast<entry&>(find(name));
+    e.name = name;
+    e.kind = special[i].kind;
+    e.uri = special[i].uri;
+  }
+  for (std::size_t i = 0; i != sizeof(namespaces) / sizeof(namespaces[0]); ++i)
+    uris_[namespaces[i].id] = dict.intern(namespaces[i].uri);
+}
+
+vocabulary::entry const& vocabulary::find(xmlChar const* name)
+const
+{
+  std::size_t h = (reinterpret_cast<std::size_t>(name) >> 4) & (slots - 1);
+  while (table_[h].name != 0 and table_[h].name != name)
+    h = (h + 1) & (slots - 1);
+  return table_[h];
+}
+
+element vocabulary::classify(xmlNode const* node)
+{
+  if (node->type != XML_ELEMENT_NODE)
+    return other_element;
+
+  element kind;
+  ns uri;
+  if (interned_)
+  {
+    entry const& e = find(node->name);
+    if (e.name == 0)
+      return other_element;
+    kind = e.kind;
+    uri = e.uri;
+  }
+  else
+  {
+    kind = lookup(xml::charptr(node->name), std::strlen(xml::charptr(node->name)), uri);
+    if (kind == other_element)
+      return other_element;
+  }
+
+  if (node->ns == 0)
+    return other_element;
+  for (std::vector<known_ns>::const_iterator n = namespaces_.begin(); n != namespaces_.end(); ++n)
+    if (n->node == node->ns)
+      return n->uri == uri ? kind : other_element;
+  known_ns n = { node->ns, namespace_of(xml::charptr(node->ns->href)) };
+  namespaces_.push_back(n);
+  return n.uri == uri ? kind : other_element;
+}
+
+element vocabulary::classify(xmlChar const* local_name, xmlChar const* uri)
+const
+{
+  if (interned_)
+  {
+    entry const& e = find(local_name);
+    return e.name != 0 and uri == uris_[e.uri] ? e.kind : other_element;
+  }
+  ns expected;
+  element const kind = lookup(xml::charptr(local_name), std::strlen(xml::charptr(local_name)), expected);
+  return kind != other_element and namespace_of(xml::charptr(uri)) == expected ? kind : other_element;
+}
+
+
+bool parse_scope(char const* list, unsigned& result)
+{
+  result = all_scope;
+  while (*list != '\0')
+  {
+    std::size_t const size = std::strcspn(list, ",");
+    std::size_t i = 0;
+    while (i != sizeof(scope_names) / sizeof(scope_names[0]) and
+           (std::strncmp(scope_names[i], list, size) != 0 or scope_names[i][size] != '\0'))
+      ++i;
+    if (i == sizeof(scope_names) / sizeof(scope_names[0]))
+      return false;
+    result |= 1u << i;
+    list += size;
+    if (*list == ',')
+      ++list;
+  }
+  return result != all_scope;
+}
+
+bool parse_meta_fields(char const* list, std::vector<meta_field>& result)
+{
+  result.clear();
+  while (*list != '\0')
+  {
+    std::size_t const size = std::strcspn(list, ",");
+    std::string const name(list, size);
+    meta_field field;
+    field.uri = 0;
+    std::string::size_type const colon = name.find(':');
+    if (colon == std::string::npos)
+      field.local_name = name;
+    else
+    {
+      std::size_t i = 0;
+      while (i != sizeof(meta_prefixes) / sizeof(meta_prefixes[0]) and name.compare(0, colon, meta_prefixes[i].prefix) != 0)
+        ++i;
+      if (i == sizeof(meta_prefixes) / sizeof(meta_prefixes[0]))
+        return false;
+      field.uri = meta_prefixes[i].uri;
+      field.local_name = name.substr(colon + 1);
+    }
+    if (field.local_name.empty())
+      return false;
+    result.push_back(field);
+    list += size;
+    if (*list == ',')
+      ++list;
+  }
+  return not result.empty();
+}
+
+
+namespace
+{
+  /// Read a repeat count, such as table:number-rows-repeated.
+  /// @returns the count, or 1 if the attribute is missing or invalid
+  unsigned long repeat_count(attributes const& attrs, char const* local_name)
+  {
+    std::string value;
+    if (not attrs.get(table_ns, local_name, value))
+      return 1;
+    char* end;
+    unsigned long const count = std::strtoul(value.c_str(), &end, 10);
+    return count == 0 or *end != '\0' ? 1 : count;
+  }
+
+  /// Append a cell reference, such as "C42", to a string.
+  void append_cell(std::string& result, unsigned long column, unsigned long row)
+  {
+    char letters[16];
+    char* p = letters + sizeof(letters);
+    for (++column; column != 0; column = (column - 1) / 26)
+      *--p = static_cast<char>('A' + (column - 1) % 26);
+    result.append(p, letters + sizeof(letters));
+    std::ostringstream number;
+    number << row + 1;
+    result += number.str();
+  }
+}
+
+sheet_position::sheet_position()
+{
+  reset();
+}
+
+void sheet_position::reset()
+{
+  sheet_.clear();
+  tables_ = 0;
+  in_row_ = in_cell_ = false;
+  row_ = column_ = 0;
+  rows_ = columns_ = 1;
+}
+
+void sheet_position::enter(element kind, attributes const& attrs)
+{
+  switch (kind)
+  {
+    case table_table:
+      if (++tables_ == 1)
+      {
+        sheet_.clear();
+        attrs.get(table_ns, "name", sheet_);
+        row_ = 0;
+      }
+      break;
+    case table_row:
+      if (tables_ == 1)
+      {
+        in_row_ = true;
+        rows_ = repeat_count(attrs, "number-rows-repeated");
+        column_ = 0;
+      }
+      break;
+    case table_cell:
+      if (tables_ == 1 and in_row_ and not in_cell_)
+      {
+        in_cell_ = true;
+        columns_ = repeat_count(attrs, "number-columns-repeated");
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void sheet_position::leave(element kind)
+{
+  switch (kind)
+  {
+    case table_table:
+      --tables_;
+      break;
+    case table_row:
+      if (tables_ == 1)
+      {
+        in_row_ = false;
+        row_ += rows_;
+      }
+      break;
+    case table_cell:
+      if (tables_ == 1 and in_cell_)
+      {
+        in_cell_ = false;
+        column_ += columns_;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+std::string sheet_position::name()
+const
+{
+  if (tables_ == 0)
+    return std::string();
+
+  // Quote the sheet name the way spreadsheet formulas do, if it needs it.
+  std::string result;
+  bool plain = not sheet_.empty();
+  for (std::string::const_iterator c = sheet_.begin(); c != sheet_.end(); ++c)
+    if (not std::isalnum(static_cast<unsigned char>(*c)) and *c != '_')
+      plain = false;
+  if (plain)
+    result = sheet_;
+  else
+  {
+    result = "'";
+    for (std::string::const_iterator c = sheet_.begin(); c != sheet_.end(); ++c)
+    {
+      if (*c == '\'')
+        result += '\'';
+      result += *c;
+    }
+    result += '\'';
+  }
+
+  if (in_cell_)
+  {
+    result += '!';
+    append_cell(result, column_, row_);
+    if (rows_ != 1 or columns_ != 1)
+    {
+      result += ':';
+      append_cell(result, column_ + columns_ - 1, row_ + rows_ - 1);
+    }
+  }
+  return result;
+}
+
+
+page_position::page_position()
+{
+  reset();
+}
+
+void page_position::reset()
+{
+  page_.clear();
+  pages_ = 0;
+  in_page_ = in_notes_ = false;
+}
+
+void page_position::enter(element kind, attributes const& attrs)
+{
+  if (kind == draw_page)
+  {
+    ++pages_;
+    in_page_ = true;
+    page_.clear();
+    attrs.get(draw_ns, "name", page_);
+  }
+  else if (kind == presentation_notes)
+    in_notes_ = true;
+}
+
+void page_position::leave(element kind)
+{
+  if (kind == draw_page)
+    in_page_ = false;
+  else if (kind == presentation_notes)
+    in_notes_ = false;
+}
+
+std::string page_position::name()
+const
+{
+  if (not in_page_)
+    return std::string();
+  std::string result = page_;
+  if (result.empty())
+  {
+    // An unnamed page is known by its number.
+    std::ostringstream number;
+    number << "page " << pages_;
+    result = number.str();
+  }
+  if (in_notes_)
+    result += " (notes)";
+  return result;
+}
+
+
+selector::selector(unsigned scope, bool search_deleted)
+: scope_(scope), search_deleted_(search_deleted)
+{
+  reset();
+}
+
+void selector::begin(element body)
+{
+  body_ = body;
+}
+
+location const* selector::where()
+const
+{
+  switch (body_)
+  {
+    case office_spreadsheet:
+      return &sheet_;
+    case office_presentation:
+    case office_drawing:
+      return &page_;
+    default:
+      return 0;
+  }
+}
+
+disposition selector::enter(element kind, attributes const& attrs)
+{
+  if (kind == no_paragraphs or (kind == text_deletion and not search_deleted_))
+    return skip;
+  if ((kind == svg_title or kind == svg_desc) and (body_ == office_presentation or body_ == office_drawing))
+    return selected(kind) ? extract : skip;
+  if (kind == text_p or kind == text_h)
+  {
+    if (selected(kind))
+      return extract;
+    // A paragraph that is out of scope can still hold a note, annotation,
+    // or frame. Anything else inside it, such as a table in a text box,
+    // is searched only as part of the frame.
+    if ((scope_ & (note_scope | annotation_scope | frame_scope)) == 0)
+      return skip;
+  }
+  open_.push_back(kind);
+  ++inside_[kind];
+  if (body_ == office_spreadsheet)
+    sheet_.enter(kind, attrs);
+  else if (body_ == office_presentation or body_ == office_drawing)
+    page_.enter(kind, attrs);
+  return descend;
+}
+
+element selector::leave()
+{
+  element const kind = open_.back();
+  --inside_[kind];
+  open_.pop_back();
+  if (body_ == office_spreadsheet)
+    sheet_.leave(kind);
+  else if (body_ == office_presentation or body_ == office_drawing)
+    page_.leave(kind);
+  return kind;
+}
+
+void selector::reset()
+{
+  open_.clear();
+  std::fill(inside_, inside_ + no_paragraphs + 1, 0);
+  body_ = other_element;
+  sheet_.reset();
+  page_.reset();
+}
+
+bool selector::selected(element kind)
+const
+{
+  return scope_ == all_scope or
+         ((scope_ & heading_scope) != 0 and kind == text_h) or
+         ((scope_ & table_scope) != 0 and inside_[table_cell] != 0) or
+         ((scope_ & note_scope) != 0 and (inside_[text_note_body] != 0 or inside_[presentation_notes] != 0)) or
+         ((scope_ & annotation_scope) != 0 and inside_[office_annotation] != 0) or
+         ((scope_ & frame_scope) != 0 and inside_[draw_frame] != 0);
+}
+
+namespace
+{
+  /** The attributes of a libxml2 tree node, for the selector.
+   */
+  struct node_attributes : attributes
+  {
+    /// @param node the element
+    node_attributes(xmlNode* node) : node_(node) {}
+    virtual bool get(ns uri, char const* local_name, std::string& value) const
+    {
+      xmlChar* text = xmlGetNsProp(node_, xml::ucharptr(local_name), xml::ucharptr(uri_of(uri)));
+      if (text == 0)
+        return false;
+      value = xml::charptr(text);
+      xmlFree(text);
+      return true;
+    }
+    xmlNode* node_; ///< the element
+  };
+
+  /** Pass the text content of an element to a sink.
+   * The content goes to the sink where libxml2 put it, without copying it to a string.
+   * @param node the element
+   * @param sink receives the content
+   * @return true to continue searching for matches or false to stop searching this file
+   */
+  bool extract_content(xmlNode* node, paragraph_sink& sink)
+  {
+    xmlChar* text = xmlNodeGetContent(node);
+    try {
+      bool result = sink.paragraph(xml::charptr(text), xmlStrlen(text));
+      xmlFree(text);
+      return result;
+    } catch(...) {
+      xmlFree(text);
+      throw;
+    }
+  }
+}
+
+bool grep_node(xmlNode* parent, vocabulary& names, selector& select, paragraph_sink& sink)
+{
+  for (xmlNode* node = parent->children ; node != 0; node = node->next)
+  {
+    if (node->type != XML_ELEMENT_NODE)
+      continue;
+    switch (select.enter(names.classify(node), node_attributes(node)))
+    {
+      case extract:
+        if (not extract_content(node, sink))
+          return false;
+        break;
+      case descend:
+      {
+        // Recursively search the contents of a section, table, list, index, etc.
+        bool const more = grep_node(node, names, select, sink);
+        select.leave();
+        if (not more)
+          return false;
+        break;
+      }
+      case skip:
+        break;
+    }
+  }
+  return true;
+}
+
+void grep_body(xmlNode* parent, vocabulary& names, unsigned scope, bool search_deleted, paragraph_sink& sink)
+{
+  for (xmlNode* node = parent->children ; node != 0; node = node->next)
+  {
+    element const kind = names.classify(node);
+    if (is_body(kind))
+    {
+      selector select(scope, search_deleted);
+      select.begin(kind);
+      sink.locate(select.where());
+      grep_node(node, names, select, sink);
+      sink.locate(0);
+      break;
+    }
+  }
+}
+
+}
@@ -0,0 +1,424 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file odf.hpp
+ * Knowledge about the structure of ODF streams that is shared by
+ * all the ways of extracting text from them.
+ */
+
+#ifndef ODF_HPP
+#define ODF_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <libxml/tree.h>
+}
+
+namespace xml
+{
+  class doc;
+  class reader;
+}
+
+/// Everything that knows about ODF vocabulary resides in this namespace.
+namespace odf
+{
+  /// The ODF namespaces that the extractors need to recognize.
+  enum ns { other_ns, office_ns, text_ns, table_ns, draw_ns, svg_ns, presentation_ns, ns_count };
+
+  /// Identify a namespace URI.
+  /// @param uri the namespace URI, which need not be NUL-terminated
+  /// @param size the number of bytes in @p uri
+  /// @returns the namespace, or @c other_ns for any namespace that is not of interest
+  ns namespace_of(char const* uri, std::size_t size);
+  /// Identify a namespace URI.
+  /// @param uri the NUL-terminated namespace URI, or a null pointer for no namespace
+  /// @returns the namespace, or @c other_ns for any namespace that is not of interest
+  inline ns namespace_of(char const* uri)
+  {
+    return uri == 0 ? other_ns : namespace_of(uri, std::strlen(uri));
+  }
+  /// @returns the URI of a namespace, or an empty string for @c other_ns
+  char const* uri_of(ns id);
+
+  /// The elements that the extractors treat specially.
+  enum element {
+    other_element,     ///< any element not listed here
+    office_meta,       ///< \<office:meta\>, which holds the metadata fields
+    office_body,       ///< \<office:body\>
+    office_text,       ///< \<office:text\>, the body of a text document
+    office_spreadsheet, ///< \<office:spreadsheet\>, the body of a spreadsheet
+    office_presentation, ///< \<office:presentation\>, the body of a presentation
+    office_drawing,    ///< \<office:drawing\>, the body of a drawing
+    office_chart,      ///< \<office:chart\>, the body of an embedded chart
+    office_master_styles, ///< \<office:master-styles\>, which holds page headers and footers
+    draw_page,         ///< \<draw:page\>, a slide or drawing page
+    presentation_notes, ///< \<presentation:notes\>, the speaker notes of a slide
+    svg_title,         ///< \<svg:title\>, the title of a shape or frame
+    svg_desc,          ///< \<svg:desc\>, the description of a shape or frame
+    text_p,            ///< \<text:p\>
+    text_h,            ///< \<text:h\>
+    text_deletion,     ///< \<text:deletion\>
+    table_table,       ///< \<table:table\>, which is a sheet in a spreadsheet
+    table_row,         ///< \<table:table-row\>
+    table_cell,        ///< \<table:table-cell\> or \<table:covered-table-cell\>
+    text_note_body,    ///< \<text:note-body\>, the text of a footnote or endnote
+    office_annotation, ///< \<office:annotation\>
+    draw_frame,        ///< \<draw:frame\>
+    no_paragraphs      ///< forms, binary data, declarations, and others that the schema says cannot contain paragraphs
+  };
+
+  /// Test whether an element is the body of a document, such as \<office:text\>.
+  inline bool is_body(element kind)
+  {
+    return kind == office_text or kind == office_spreadsheet or
+           kind == office_presentation or kind == office_drawing or
+           kind == office_chart;
+  }
+
+  /** Test whether a file is a flat ODF document, that is, a single XML
+   * stream such as a .fodt file, instead of a ZIP package.
+   * @param data the start of the file; a few dozen bytes are enough
+   * @param size the number of bytes in @p data
+   * @returns true if the file looks like XML
+   */
+  bool is_flat(char const* data, std::size_t size);
+
+  /** Read the media type of a document from the start of the file.
+   * A package begins with an uncompressed "mimetype" entry, so its local
+   * ZIP header and contents fit in about a hundred bytes. A flat document
+   * has an office:mimetype attribute on its root element.
+   * @param data the start of the file; a few kilobytes are enough
+   * @param size the number of bytes in @p data
+   * @returns the media type, or an empty string if @p data does not reveal it
+   */
+  std::string mimetype_of(char const* data, std::size_t size);
+
+  /// Test whether a media type is that of an ODF document.
+  /// @param mimetype the media type, such as "application/vnd.oasis.opendocument.text"
+  bool is_odf(std::string const& mimetype);
+
+  /// Parse a comma-separated list of document types, e.g., "text,spreadsheet".
+  /// The types are text, spreadsheet, presentation, drawing, chart, and formula.
+  /// @param list the list from the command line
+  /// @param[out] result the media subtypes, such as "graphics" for drawing
+  /// @returns false if @p list contains an unknown type
+  bool parse_types(char const* list, std::vector<std::string>& result);
+
+  /// Test whether a media type is one of the document types from parse_types().
+  /// A template or master document, such as "text-template", has the type of
+  /// the documents that it makes.
+  /// @param mimetype the media type, such as "application/vnd.oasis.opendocument.text"
+  /// @param types the media subtypes
+  bool is_type(std::string const& mimetype, std::vector<std::string> const& types);
+
+  /// A stream that is listed in a package's META-INF/manifest.xml.
+  struct manifest_entry
+  {
+    std::string path;       ///< the full path of the stream in the package
+    std::string media_type; ///< the media type, which may be empty
+    bool encrypted;         ///< true if the stream has \<manifest:encryption-data\>
+  };
+
+  /** Read the manifest of a package.
+   * @param text the contents of META-INF/manifest.xml
+   * @param size the number of bytes in @p text
+   * @returns the file entries, in the order in which the manifest lists them
+   * @throw std::runtime_error if the manifest cannot be parsed
+   */
+  std::vector<manifest_entry> read_manifest(char const* text, std::size_t size);
+
+  /** Pick the streams of a package that hold searchable text: the
+   * content.xml and styles.xml of the document and of each embedded
+   * object, such as "Object 1/content.xml". Encrypted streams are left
+   * out, because they cannot be read without the password.
+   * @param manifest the entries returned by read_manifest()
+   * @returns the stream paths, with the document's content.xml first
+   * and its styles.xml second, if the manifest lists them
+   */
+  std::vector<std::string> text_streams(std::vector<manifest_entry> const& manifest);
+
+  /** Look up an element by its local name alone.
+   * The local names of the elements in ::element are all distinct,
+   * so the caller need resolve the namespace prefix only when this
+   * function returns something other than @c other_element.
+   * @param local_name the local name, which need not be NUL-terminated
+   * @param size the number of bytes in @p local_name
+   * @param[out] uri the namespace in which @p local_name is special
+   * @returns the element, or @c other_element
+   */
+  element lookup(char const* local_name, std::size_t size, ns& uri);
+
+  /** Classify elements by the interned names of a libxml2 parse.
+   * libxml2 interns element names in a dictionary, so each name is
+   * compared by pointer instead of by string. For a tree, the namespace
+   * of each xmlNs is looked up once and remembered, so the tree must
+   * outlive the vocabulary.
+   */
+  class vocabulary
+  {
+  public:
+    /// Intern the names in a parsed document's dictionary.
+    explicit vocabulary(xml::doc& doc);
+    /// Intern the names in a reader's dictionary.
+    explicit vocabulary(xml::reader& reader);
+
+    /// Classify an element in a tree.
+    element classify(xmlNode const* node);
+    /// Classify an element by interned names, as returned by xml::reader.
+    /// @param local_name the interned local name
+    /// @param uri the interned namespace URI, or null
+    element classify(xmlChar const* local_name, xmlChar const* uri) const;
+
+  private:
+    /// An interned element name.
+    struct entry
+    {
+      xmlChar const* name; ///< the interned local name, or null for an empty slot
+      element kind;        ///< the element that @c name stands for
+      ns uri;              ///< the namespace in which @c name is special
+    };
+    /// A namespace node whose URI has been looked up.
+    struct known_ns
+    {
+      xmlNs const* node; ///< the namespace node
+      ns uri;            ///< the namespace that @c node declares
+    };
+    static std::size_t const slots = 64; ///< size of @c table_, a power of two
+
+    /// Fill the tables with names from a dictionary.
+    template<class Dictionary> void intern(Dictionary& dict);
+    /// Find the entry for an interned name, or an empty entry.
+    entry const& find(xmlChar const* name) const;
+
+    bool interned_;                   ///< false if the parse had no dictionary
+    entry table_[slots];              ///< interned names, hashed by address
+    xmlChar const* uris_[ns_count];   ///< interned namespace URIs, indexed by ::ns
+    std::vector<known_ns> namespaces_; ///< namespace nodes seen so far
+  };
+
+  /// The structures that --scope can select. Zero means everything.
+  enum scope {
+    all_scope = 0,
+    heading_scope = 1,    ///< \<text:h\>
+    table_scope = 2,      ///< paragraphs in table cells
+    note_scope = 4,       ///< paragraphs in footnotes, endnotes, and speaker notes
+    annotation_scope = 8, ///< paragraphs in annotations
+    frame_scope = 16      ///< paragraphs in frames, such as text boxes
+  };
+
+  /// Parse a comma-separated list of scope names, e.g., "headings,tables".
+  /// @param list the list from the command line
+  /// @param[out] result the bitwise-or of ::scope values
+  /// @returns false if @p list contains an unknown name
+  bool parse_scope(char const* list, unsigned& result);
+
+  /// A metadata field, such as \<dc:creator\>, that --meta-field selects.
+  struct meta_field
+  {
+    char const* uri;        ///< the namespace URI, or a null pointer for any namespace
+    std::string local_name; ///< the local name, such as "creator"
+  };
+
+  /// Parse a comma-separated list of metadata fields, e.g., "dc:creator,meta:keyword".
+  /// The prefixes are the ones that the ODF standard uses, dc and meta.
+  /// A field without a prefix matches in either namespace.
+  /// @param list the list from the command line
+  /// @param[out] result the fields
+  /// @returns false if @p list contains an unknown prefix or an empty name
+  bool parse_meta_fields(char const* list, std::vector<meta_field>& result);
+
+  /** Describes where in a stream the current paragraph is.
+   * The description is made only when it is needed, such as for a match.
+   */
+  struct location
+  {
+    virtual ~location() {}
+    /// @returns a name for the current position, e.g., "Sheet1!C42", or an empty string
+    virtual std::string name() const = 0;
+  };
+
+  /// Gives the selector the attributes of the element that an extractor is entering.
+  struct attributes
+  {
+    virtual ~attributes() {}
+    /** Get an attribute.
+     * @param uri the attribute's namespace
+     * @param local_name the attribute's local name
+     * @param[out] value the attribute's value, if it is present
+     * @returns true if the attribute is present
+     */
+    virtual bool get(ns uri, char const* local_name, std::string& value) const = 0;
+  };
+
+  /** Track the cell that a spreadsheet paragraph is in.
+   * Rows and cells that repeat are counted, not expanded, so a blank row
+   * that is repeated a million times costs no more than one row.
+   * Tables inside cells do not move the position.
+   */
+  class sheet_position : public location
+  {
+  public:
+    sheet_position();
+    /// Start a new spreadsheet.
+    void reset();
+    /// Enter an element, reading the sheet name and repeat counts from its attributes.
+    void enter(element kind, attributes const& attrs);
+    /// Leave an element, and move past the rows or cells that it covers.
+    void leave(element kind);
+    /// @returns the sheet and cell, such as "Sheet1!C42", or a range such as "Sheet1!C42:C50" for a repeated cell
+    virtual std::string name() const;
+
+  private:
+    std::string sheet_;            ///< the name of the current sheet
+    std::size_t tables_;           ///< number of open \<table:table\> elements
+    bool in_row_;                  ///< true inside a row of the sheet
+    bool in_cell_;                 ///< true inside a cell of the sheet
+    unsigned long row_;            ///< zero-based index of the current row
+    unsigned long column_;         ///< zero-based index of the current column
+    unsigned long rows_;           ///< number of times the current row repeats
+    unsigned long columns_;        ///< number of times the current cell repeats
+  };
+
+  /** Track the slide or page that a paragraph is on.
+   */
+  class page_position : public location
+  {
+  public:
+    page_position();
+    /// Start a new presentation or drawing.
+    void reset();
+    /// Enter an element, reading the page name from its attributes.
+    void enter(element kind, attributes const& attrs);
+    /// Leave an element.
+    void leave(element kind);
+    /// @returns the page name, such as "page1", and "(notes)" for the speaker notes
+    virtual std::string name() const;
+
+  private:
+    std::string page_;      ///< the name of the current page
+    unsigned long pages_;   ///< number of pages so far, including the current page
+    bool in_page_;          ///< true inside a page
+    bool in_notes_;         ///< true inside the speaker notes
+  };
+
+  /// What an extractor should do with an element inside the document body.
+  enum disposition {
+    descend, ///< look inside the element, and call selector::leave() at its end
+    skip,    ///< skip the element and everything inside it
+    extract  ///< pass the element's text to the sink as a paragraph
+  };
+
+  /** Decide which elements in the body text hold the paragraphs to search.
+   * Every extractor tells the selector about each element that it
+   * enters below the document body, such as \<office:text\>, so all
+   * extractors prune the same subtrees: deleted text (unless it is
+   * searched), elements that cannot contain paragraphs, and, when the
+   * search is limited by --scope, paragraphs that cannot contain anything
+   * in scope. In a spreadsheet, the selector also tracks the current cell,
+   * and in a presentation or drawing, the current page. Presentations and
+   * drawings also have searchable titles and descriptions of shapes.
+   */
+  class selector
+  {
+  public:
+    /// @param scope the bitwise-or of ::scope values
+    /// @param search_deleted true to extract paragraphs inside \<text:deletion\>
+    selector(unsigned scope, bool search_deleted);
+
+    /// Start the body of a document.
+    /// @param body the body element, such as @c office_text
+    void begin(element body);
+    /// Enter an element.
+    /// @param kind the element
+    /// @param attrs the element's attributes
+    /// @returns what to do with it; only @c descend needs a matching leave()
+    disposition enter(element kind, attributes const& attrs);
+    /// Leave the innermost element that was entered with @c descend.
+    /// @returns the element
+    element leave();
+    /// Forget all the open elements, to start a new stream.
+    void reset();
+    /// @returns the position of the current paragraph, or null if the body has no positions to report
+    location const* where() const;
+
+  private:
+    /// Test whether a paragraph is in scope, given its ancestors.
+    bool selected(element kind) const;
+
+    unsigned const scope_;        ///< the structures to search, or @c all_scope
+    bool const search_deleted_;   ///< true to extract text inside \<text:deletion\>
+    std::vector<element> open_;   ///< elements entered with @c descend, innermost last
+    std::size_t inside_[no_paragraphs + 1]; ///< number of open elements of each kind
+    element body_;                ///< the document body, such as @c office_text
+    sheet_position sheet_;        ///< the current cell in a spreadsheet
+    page_position page_;          ///< the current page in a presentation or drawing
+  };
+
+  /** Receives the paragraphs that an extractor finds, in document order.
+   * The text is UTF-8. It is valid only for the duration of the call.
+   */
+  struct paragraph_sink
+  {
+    paragraph_sink() : where_(0) {}
+    virtual ~paragraph_sink() {}
+    /// Extractors that know where each paragraph is, such as the cell
+    /// in a spreadsheet, point the sink at the current position.
+    /// @param where the position, which must outlive the extraction, or null
+    void locate(location const* where) { where_ = where; }
+    /// @returns the position of the current paragraph, or null
+    location const* where() const { return where_; }
+    /** Accept one paragraph.
+     * @param text the paragraph text, which is not NUL-terminated
+     * @param size the number of bytes in @p text
+     * @return true to continue extracting or false to stop
+     */
+    virtual bool paragraph(char const* text, std::size_t size) = 0;
+  private:
+    location const* where_; ///< the current position, or null
+  };
+
+  /** Pass the paragraphs below an element of a libxml2 tree to a sink.
+   * @param parent the element, such as \<office:text\> or a section inside it
+   * @param names classifies the elements
+   * @param select picks the paragraphs to search and the subtrees to skip
+   * @param sink receives each paragraph
+   * @return true to continue searching or false if @p sink asked to stop
+   */
+  bool grep_node(xmlNode* parent, vocabulary& names, selector& select, paragraph_sink& sink);
+
+  /** Pass the paragraphs of a document body to a sink.
+   * Find the \<text\>, \<spreadsheet\>, \<presentation\>, or \<drawing\>
+   * element as a child of \<body\>.
+   * @param parent the \<body\> element
+   * @param names classifies the elements
+   * @param scope the structures to search, as a bitwise-or of ::scope values
+   * @param search_deleted true to extract paragraphs inside \<text:deletion\>
+   * @param sink receives each paragraph
+   */
+  void grep_body(xmlNode* parent, vocabulary& names, unsigned scope, bool search_deleted, paragraph_sink& sink);
+}
+
+#endif
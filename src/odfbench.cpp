@@ -0,0 +1,422 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file odfbench.cpp
+ * Microbenchmarks for each stage of a search: reading a stream from a
+ * package, parsing it and walking the tree, scanning it, converting
+ * paragraphs to UTF-32, matching a regular expression, and writing the
+ * output of an action. The results are JSON, so they can be saved and
+ * compared across commits. Use odfgen to make a corpus to run them on.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/regex.hpp>
+
+#include "action.hpp"
+#include "odf.hpp"
+#include "output.hpp"
+#include "scanner.hpp"
+#include "unicode.hpp"
+#include "xml.hpp"
+#include "zip.hpp"
+
+extern "C" {
+#include <argp.h>
+#include <libxml/tree.h>
+}
+
+namespace
+{
+
+/// Keys for options that have only a long name.
+enum long_option { min_time_option = 256, pattern_option };
+
+double min_time = 0.5;              ///< run each benchmark for at least this many seconds, from --min-time
+std::string pattern = "e[a-z]+";    ///< the regular expression for the regex benchmark, from --pattern
+std::vector<std::string> filenames; ///< the documents in the corpus
+
+/// A content stream of a document in the corpus.
+struct stream
+{
+  std::string filename; ///< the document
+  std::string content;  ///< content.xml, or the whole of a flat document
+  bool package;         ///< true for a package, false for a flat document
+};
+
+std::vector<stream> corpus;         ///< the content of every document
+std::vector<std::string> paragraphs; ///< the paragraphs of every document, in order
+std::size_t paragraph_bytes = 0;    ///< the number of bytes in @c paragraphs
+std::size_t content_bytes = 0;      ///< the number of bytes in the content of @c corpus
+
+/// @return the monotonic time in seconds
+double now()
+{
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/** One benchmark. A derived class runs the stage once over the whole corpus.
+ */
+class benchmark
+{
+public:
+  /// @param name the name in the results
+  explicit benchmark(char const* name) : name_(name) {}
+  virtual ~benchmark() {}
+  /// @return the name in the results
+  char const* name() const { return name_; }
+  /// Run the stage once over the corpus.
+  /// @return the number of bytes that the stage processed
+  virtual std::size_t run() = 0;
+  /// @return a number that depends on the work, such as a count of matches, so it cannot be optimized away
+  unsigned long result() const { return result_; }
+protected:
+  unsigned long result_; ///< set by run()
+private:
+  char const* name_;     ///< the name in the results
+};
+
+/// Read content.xml from each package, inflating it.
+struct zip_read : benchmark
+{
+  zip_read() : benchmark("zip_read") {}
+  virtual std::size_t run()
+  {
+    std::size_t bytes = 0;
+    for (std::vector<stream>::iterator s = corpus.begin(); s != corpus.end(); ++s)
+    {
+      if (not s->package)
+        continue;
+      Zip::Archive zip(s->filename);
+      Zip::File file(zip, "content.xml");
+      bytes += file.read().size();
+    }
+    result_ = bytes;
+    return bytes;
+  }
+};
+
+/// Parse each stream with libxml2.
+struct xml_parse : benchmark
+{
+  xml_parse() : benchmark("xml_parse") {}
+  virtual std::size_t run()
+  {
+    std::size_t bytes = 0;
+    result_ = 0;
+    for (std::vector<stream>::iterator s = corpus.begin(); s != corpus.end(); ++s)
+    {
+      xml::doc doc;
+      if (not doc.parse(s->content.data(), s->content.size()))
+        throw std::runtime_error(s->filename + ": cannot parse XML");
+      result_ += (doc.get_root_element() != 0);
+      bytes += s->content.size();
+    }
+    return bytes;
+  }
+};
+
+/// Count the paragraphs that an extractor finds.
+struct counting_sink : odf::paragraph_sink
+{
+  counting_sink() : count(0), bytes(0) {}
+  virtual bool paragraph(char const*, std::size_t size)
+  {
+    ++count;
+    bytes += size;
+    return true;
+  }
+  unsigned long count; ///< the number of paragraphs
+  std::size_t bytes;   ///< the number of bytes in the paragraphs
+};
+
+/// Keep the paragraphs that an extractor finds.
+struct collecting_sink : odf::paragraph_sink
+{
+  virtual bool paragraph(char const* text, std::size_t size)
+  {
+    paragraphs.push_back(std::string(text, size));
+    paragraph_bytes += size;
+    return true;
+  }
+};
+
+/// Parse each stream with libxml2 and walk the tree with odf::grep_node, as --extractor=dom does.
+struct dom_extract : benchmark
+{
+  dom_extract() : benchmark("xml_parse_grep_node") {}
+  virtual std::size_t run()
+  {
+    std::size_t bytes = 0;
+    counting_sink sink;
+    for (std::vector<stream>::iterator s = corpus.begin(); s != corpus.end(); ++s)
+    {
+      xml::doc doc;
+      if (not doc.parse(s->content.data(), s->content.size()))
+        throw std::runtime_error(s->filename + ": cannot parse XML");
+      odf::vocabulary names(doc);
+      for (xmlNode* node = doc.get_root_element()->children ; node != 0; node = node->next)
+      {
+        odf::element const kind = names.classify(node);
+        if (kind == odf::office_master_styles)
+        {
+          odf::selector select(odf::all_scope, false);
+          select.begin(kind);
+          odf::grep_node(node, names, select, sink);
+        }
+        else if (kind == odf::office_body)
+        {
+          odf::grep_body(node, names, odf::all_scope, false, sink);
+          break;
+        }
+      }
+      bytes += s->content.size();
+    }
+    result_ = sink.count;
+    return bytes;
+  }
+};
+
+/// Scan each stream with odf::scanner, as --extractor=fast does.
+struct scan : benchmark
+{
+  scan() : benchmark("scanner") {}
+  virtual std::size_t run()
+  {
+    std::size_t bytes = 0;
+    counting_sink sink;
+    for (std::vector<stream>::iterator s = corpus.begin(); s != corpus.end(); ++s)
+    {
+      odf::scanner scanner(odf::all_scope, false);
+      scanner.scan(s->content.data(), s->content.size(), sink);
+      bytes += s->content.size();
+    }
+    result_ = sink.count;
+    return bytes;
+  }
+};
+
+/// Convert each paragraph to UTF-32, as for a case-insensitive search.
+struct widen : benchmark
+{
+  widen() : benchmark("utf8_to_utf32") {}
+  virtual std::size_t run()
+  {
+    std::vector<wchar_t> buffer;
+    result_ = 0;
+    for (std::vector<std::string>::iterator p = paragraphs.begin(); p != paragraphs.end(); ++p)
+    {
+      buffer.resize(p->size() + 1);
+      result_ += utf8_to_utf32(p->data(), p->size(), &buffer[0]);
+    }
+    return paragraph_bytes;
+  }
+};
+
+/// Search each paragraph for --pattern, converted to UTF-32 as odfgrep does.
+struct regex_match : benchmark
+{
+  regex_match() : benchmark("regex_search"), regex_(utf8_to_utf32(pattern)) {}
+  virtual std::size_t run()
+  {
+    result_ = 0;
+    for (std::vector<std::string>::iterator p = paragraphs.begin(); p != paragraphs.end(); ++p)
+      if (boost::regex_search(utf8_to_utf32(*p), regex_, boost::match_any))
+        ++result_;
+    return paragraph_bytes;
+  }
+private:
+  boost::wregex regex_; ///< the compiled pattern
+};
+
+/// Print each paragraph with its file name, as odfgrep does for a match.
+struct action_output : benchmark
+{
+  action_output() : benchmark("action_output") {}
+  virtual std::size_t run()
+  {
+    output_buffer buffer;
+    output_buffer::scope redirect(buffer);
+    echo_text echo;
+    echo.initialize();
+    std::string const filename = "doc00000.odt";
+    for (std::vector<std::string>::iterator p = paragraphs.begin(); p != paragraphs.end(); ++p)
+      echo.perform(*p, filename);
+    echo.finish_file(filename, paragraphs.size());
+    result_ = buffer.size();
+    return paragraph_bytes;
+  }
+};
+
+/** Read the content of every document in the corpus, and extract its paragraphs.
+ * @throw std::runtime_error or Zip::Exception for a document that cannot be read
+ */
+void load_corpus()
+{
+  for (std::vector<std::string>::iterator f = filenames.begin(); f != filenames.end(); ++f)
+  {
+    stream s;
+    s.filename = *f;
+    std::FILE* in = std::fopen(f->c_str(), "rb");
+    if (in == 0)
+      throw std::runtime_error(*f + ": " + std::strerror(errno));
+    char buffer[65536];
+    std::size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), in)) != 0)
+      s.content.append(buffer, n);
+    std::fclose(in);
+    s.package = not odf::is_flat(s.content.data(), s.content.size());
+    if (s.package)
+    {
+      Zip::Archive zip(*f);
+      Zip::File file(zip, "content.xml");
+      s.content = file.read();
+    }
+    content_bytes += s.content.size();
+    corpus.push_back(s);
+
+    collecting_sink sink;
+    odf::scanner scanner(odf::all_scope, false);
+    scanner.scan(corpus.back().content.data(), corpus.back().content.size(), sink);
+  }
+}
+
+/** Run a benchmark until it has taken --min-time, and print its result.
+ * @param bench the benchmark
+ * @param first true for the first benchmark in the list
+ */
+void measure(benchmark& bench, bool first)
+{
+  bench.run(); // warm the caches
+  unsigned long iterations = 0;
+  std::size_t bytes = 0;
+  double const start = now();
+  double elapsed;
+  do
+  {
+    bytes += bench.run();
+    ++iterations;
+    elapsed = now() - start;
+  } while (elapsed < min_time);
+
+  char line[512];
+  std::sprintf(line, "%s    {\"name\": \"%s\", \"iterations\": %lu, \"bytes\": %lu, \"seconds\": %.6f, "
+               "\"ns_per_iteration\": %.0f, \"mb_per_second\": %.2f, \"result\": %lu}",
+               first ? "" : ",\n", bench.name(), iterations, static_cast<unsigned long>(bytes / iterations),
+               elapsed, elapsed * 1e9 / iterations, bytes / elapsed / 1e6, bench.result());
+  std::cout << line << std::flush;
+}
+
+extern "C" error_t parse_func(int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+  {
+    case min_time_option:
+    {
+      char* end;
+      min_time = std::strtod(arg, &end);
+      if (*arg == '\0' or *end != '\0' or min_time < 0)
+      {
+        std::cerr << "Not a number of seconds: " << arg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    }
+    case pattern_option:
+      pattern = arg;
+      break;
+    case ARGP_KEY_ARG:
+      filenames.push_back(arg);
+      break;
+    case ARGP_KEY_FINI:
+      if (filenames.empty())
+        argp_usage(state); // does not return
+      break;
+    case ARGP_KEY_INIT:
+    case ARGP_KEY_END:
+    case ARGP_KEY_SUCCESS:
+    case ARGP_KEY_NO_ARGS:
+      break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+} // end of namespace
+
+/** Run the benchmarks.
+ * @param argc number of command line arguments
+ * @param argv the command line arguments
+ * @returns 0 for success, EXIT_FAILURE if anything goes wrong.
+ */
+int main(int argc, char *argv[])
+{
+  static argp_option options[] = {
+    { "min-time", min_time_option, "SECONDS", 0, "run each benchmark for at least SECONDS (default 0.5)" },
+    { "pattern",  pattern_option, "PATTERN", 0, "search each paragraph for PATTERN in the regex benchmark (default e[a-z]+)" },
+    { 0 }
+  };
+  static argp parse_info = { options, parse_func, "DOCUMENTS...",
+    "Time each stage of a search over DOCUMENTS, and print the results as JSON.\v"
+        "Make DOCUMENTS with odfgen, so the results can be compared across commits."
+  };
+
+  try {
+    argp_parse(&parse_info, argc, argv, 0, 0, 0);
+    xml::parser parser;
+    load_corpus();
+
+    std::cout << "{\n  \"corpus\": {\"documents\": " << corpus.size()
+              << ", \"content_bytes\": " << content_bytes
+              << ", \"paragraphs\": " << paragraphs.size()
+              << ", \"paragraph_bytes\": " << paragraph_bytes << "},\n"
+              << "  \"benchmarks\": [\n";
+    zip_read zip;
+    xml_parse parse;
+    dom_extract dom;
+    scan scanner;
+    widen utf32;
+    regex_match regex;
+    action_output output;
+    benchmark* const benchmarks[] = { &zip, &parse, &dom, &scanner, &utf32, &regex, &output };
+    for (std::size_t b = 0; b != sizeof(benchmarks) / sizeof(benchmarks[0]); ++b)
+      measure(*benchmarks[b], b == 0);
+    std::cout << "\n  ]\n}\n";
+  } catch (std::exception& ex) {
+    std::cerr << ex.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
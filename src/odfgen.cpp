@@ -0,0 +1,386 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file odfgen.cpp
+ * Generate a synthetic corpus of ODF documents for benchmarks.
+ * The corpus depends only on the options, including the seed, so two
+ * runs with the same options write the same documents, and a benchmark
+ * can be compared across commits.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "zip.hpp"
+
+extern "C" {
+#include <argp.h>
+#include <sys/stat.h>
+}
+
+namespace
+{
+
+/// What kind of documents to generate.
+enum document_kind { text_kind, spreadsheet_kind, mixed_kind };
+
+/// Keys for options that have only a long name.
+enum long_option {
+  changes_option = 256, depth_option, documents_option, flat_option, length_option,
+  paragraphs_option, repeat_option, seed_option, type_option, unicode_option
+};
+
+unsigned long seed = 1;           ///< Seed for the random numbers, from --seed
+unsigned long document_count = 10;   ///< Number of documents, from --documents
+unsigned long paragraph_count = 1000; ///< Paragraphs or cells in each document, from --paragraphs
+unsigned long paragraph_length = 12;  ///< Average number of words in a paragraph, from --length
+unsigned long unicode_percent = 10;   ///< Percent of words that are not ASCII, from --unicode
+unsigned long depth = 1;          ///< Levels of spans around the words of a paragraph, from --depth
+unsigned long change_percent = 0; ///< Percent of paragraphs with a tracked change, from --changes
+unsigned long repeat = 0;         ///< Repeat count of the repeated rows and cells in a spreadsheet, from --repeat
+document_kind kind = mixed_kind;  ///< What kind of documents to generate, from --type
+bool flat = false;                ///< Write flat documents instead of packages, from --flat
+char const* directory = 0;        ///< Where to write the corpus
+
+/// Words in ASCII.
+char const* const ascii_words[] = {
+  "the", "of", "and", "document", "paragraph", "search", "pattern", "text", "office", "open",
+  "format", "table", "cell", "value", "heading", "section", "report", "budget", "meeting", "review",
+  "quarter", "revenue", "estimate", "draft", "final", "change", "author", "editor", "version", "page",
+  "alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta", "iota", "kappa",
+  "AT&amp;T", "x&lt;y"
+};
+
+/// Words in other scripts, with two, three, and four bytes per character in UTF-8.
+char const* const unicode_words[] = {
+  "Stra\xc3\x9f" "e", "na\xc3\xafve", "caf\xc3\xa9", "\xce\xbb\xcf\x8c\xce\xb3\xce\xbf\xcf\x82",
+  "\xd1\x81\xd0\xbb\xd0\xbe\xd0\xb2\xd0\xbe", "\xd9\x83\xd9\x84\xd9\x85\xd8\xa9",
+  "\xe8\xa8\x80\xe8\x91\x89", "\xe0\xa4\xb6\xe0\xa4\xac\xe0\xa5\x8d\xe0\xa4\xa6",
+  "\xe2\x82\xac" "100", "\xf0\x9f\x99\x82", "\xf0\x9d\x94\xb8\xf0\x9d\x94\xb9"
+};
+
+/// The namespaces that the generated streams use.
+char const namespaces[] =
+  " xmlns:office=\"urn:oasis:names:tc:opendocument:xmlns:office:1.0\""
+  " xmlns:text=\"urn:oasis:names:tc:opendocument:xmlns:text:1.0\""
+  " xmlns:table=\"urn:oasis:names:tc:opendocument:xmlns:table:1.0\""
+  " xmlns:meta=\"urn:oasis:names:tc:opendocument:xmlns:meta:1.0\""
+  " xmlns:dc=\"http://purl.org/dc/elements/1.1/\""
+  " office:version=\"1.2\"";
+
+char const text_mimetype[] = "application/vnd.oasis.opendocument.text";               ///< media type of a text document
+char const spreadsheet_mimetype[] = "application/vnd.oasis.opendocument.spreadsheet"; ///< media type of a spreadsheet
+
+/** A small pseudo-random number generator (xorshift64*), so the corpus
+ * is the same on every platform, whatever the C library's rand() does.
+ */
+class random_numbers
+{
+public:
+  /// @param seed the seed, which may be any number
+  explicit random_numbers(unsigned long long seed) : state_(seed * 2685821657736338717ULL + 1) {}
+  /// @return a number in [0, @p n)
+  unsigned long next(unsigned long n)
+  {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return static_cast<unsigned long>((state_ * 2685821657736338717ULL) >> 32) % n;
+  }
+  /// @return true @p percent percent of the time
+  bool chance(unsigned long percent) { return next(100) < percent; }
+private:
+  unsigned long long state_; ///< never zero
+};
+
+/** Append the words of one paragraph, nested in --depth levels of spans.
+ * @param out receives the XML
+ * @param random the random numbers
+ */
+void words(std::string& out, random_numbers& random)
+{
+  unsigned long const count = 1 + random.next(2 * paragraph_length);
+  for (unsigned long d = 0; d != depth; ++d)
+    out += "<text:span>";
+  for (unsigned long w = 0; w != count; ++w)
+  {
+    if (w != 0)
+      out += ' ';
+    if (random.chance(unicode_percent))
+      out += unicode_words[random.next(sizeof(unicode_words) / sizeof(unicode_words[0]))];
+    else
+      out += ascii_words[random.next(sizeof(ascii_words) / sizeof(ascii_words[0]))];
+  }
+  for (unsigned long d = 0; d != depth; ++d)
+    out += "</text:span>";
+}
+
+/** Make the body of a text document.
+ * A paragraph with a tracked change marks where text was deleted, and
+ * the deleted paragraph goes in \<text:tracked-changes\>, which odfgrep
+ * searches only with --deleted.
+ * @param random the random numbers
+ * @return the \<office:text\> element
+ */
+std::string text_body(random_numbers& random)
+{
+  std::string changes;
+  std::string paragraphs;
+  for (unsigned long p = 0; p != paragraph_count; ++p)
+  {
+    bool const heading = (p % 50 == 0);
+    paragraphs += heading ? "<text:h text:outline-level=\"1\">" : "<text:p>";
+    words(paragraphs, random);
+    if (random.chance(change_percent))
+    {
+      std::ostringstream id;
+      id << "ct" << p;
+      changes += "<text:changed-region text:id=\"" + id.str() + "\"><text:deletion><office:change-info>"
+                 "<dc:creator>odfgen</dc:creator><dc:date>2000-01-01T00:00:00</dc:date></office:change-info><text:p>";
+      words(changes, random);
+      changes += "</text:p></text:deletion></text:changed-region>";
+      paragraphs += "<text:change text:change-id=\"" + id.str() + "\"/>";
+    }
+    paragraphs += heading ? "</text:h>\n" : "</text:p>\n";
+  }
+  if (not changes.empty())
+    changes = "<text:tracked-changes>" + changes + "</text:tracked-changes>\n";
+  return "<office:text>\n" + changes + paragraphs + "</office:text>";
+}
+
+/** Make the body of a spreadsheet with eight columns.
+ * With --repeat, every tenth row and every fifth cell is repeated.
+ * @param random the random numbers
+ * @return the \<office:spreadsheet\> element
+ */
+std::string spreadsheet_body(random_numbers& random)
+{
+  unsigned long const columns = 8;
+  std::ostringstream repeated;
+  repeated << repeat;
+  std::string out = "<office:spreadsheet>\n<table:table table:name=\"Sheet1\">\n";
+  for (unsigned long p = 0; p < paragraph_count; p += columns)
+  {
+    unsigned long const row = p / columns;
+    out += (repeat > 1 and row % 10 == 9) ?
+      "<table:table-row table:number-rows-repeated=\"" + repeated.str() + "\">" : std::string("<table:table-row>");
+    for (unsigned long c = 0; c != columns; ++c)
+    {
+      out += (repeat > 1 and c % 5 == 4) ?
+        "<table:table-cell office:value-type=\"string\" table:number-columns-repeated=\"" + repeated.str() + "\">" :
+        std::string("<table:table-cell office:value-type=\"string\">");
+      out += "<text:p>";
+      words(out, random);
+      out += "</text:p></table:table-cell>";
+    }
+    out += "</table:table-row>\n";
+  }
+  return out + "</table:table>\n</office:spreadsheet>";
+}
+
+/// @return the declaration that starts each stream
+std::string declaration()
+{
+  return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+}
+
+/** Write one document.
+ * @param index the number of the document, from 0
+ * @param random the random numbers
+ * @throw Zip::Exception or std::runtime_error if the document cannot be written
+ */
+void write_document(unsigned long index, random_numbers& random)
+{
+  bool const spreadsheet = (kind == spreadsheet_kind or (kind == mixed_kind and index % 2 == 1));
+  char const* const mimetype = spreadsheet ? spreadsheet_mimetype : text_mimetype;
+  std::string const body = spreadsheet ? spreadsheet_body(random) : text_body(random);
+  char name[32];
+  std::sprintf(name, "doc%05lu.%s%s", index, flat ? "f" : "", spreadsheet ? "ods" : "odt");
+  std::string const path = std::string(directory) + '/' + name;
+
+  if (flat)
+  {
+    std::ofstream out(path.c_str(), std::ios_base::out | std::ios_base::binary);
+    out << declaration() << "<office:document" << namespaces << " office:mimetype=\"" << mimetype << "\">\n"
+        << "<office:body>\n" << body << "\n</office:body>\n</office:document>\n";
+    out.close();
+    if (not out)
+      throw std::runtime_error(path + ": " + std::strerror(errno));
+    return;
+  }
+
+  std::remove(path.c_str());
+  Zip::Archive zip(path, Zip::Archive::create);
+  zip.add_stored("mimetype", mimetype);
+  zip.add("content.xml", declaration() + "<office:document-content" + namespaces + ">\n"
+          "<office:body>\n" + body + "\n</office:body>\n</office:document-content>\n");
+  zip.add("styles.xml", declaration() + "<office:document-styles" + namespaces + ">\n"
+          "<office:master-styles/>\n</office:document-styles>\n");
+  zip.add("meta.xml", declaration() + "<office:document-meta" + namespaces + ">\n"
+          "<office:meta><dc:title>" + name + "</dc:title><meta:generator>odfgen</meta:generator></office:meta>\n"
+          "</office:document-meta>\n");
+  zip.add("META-INF/manifest.xml", declaration() +
+          "<manifest:manifest xmlns:manifest=\"urn:oasis:names:tc:opendocument:xmlns:manifest:1.0\">\n"
+          " <manifest:file-entry manifest:full-path=\"/\" manifest:media-type=\"" + mimetype + "\"/>\n"
+          " <manifest:file-entry manifest:full-path=\"content.xml\" manifest:media-type=\"text/xml\"/>\n"
+          " <manifest:file-entry manifest:full-path=\"styles.xml\" manifest:media-type=\"text/xml\"/>\n"
+          " <manifest:file-entry manifest:full-path=\"meta.xml\" manifest:media-type=\"text/xml\"/>\n"
+          "</manifest:manifest>\n");
+  zip.close();
+}
+
+/** Parse a number for an option, and exit if it is not one.
+ * @param arg the option's argument
+ * @param max the largest number that makes sense
+ * @return the number
+ */
+unsigned long parse_number(char const* arg, unsigned long max)
+{
+  char* end;
+  unsigned long const n = std::strtoul(arg, &end, 10);
+  if (*arg == '\0' or *end != '\0' or n > max)
+  {
+    std::cerr << "Not a number from 0 to " << max << ": " << arg << '\n';
+    std::exit(EXIT_FAILURE);
+  }
+  return n;
+}
+
+extern "C" error_t parse_func(int key, char *arg, struct argp_state *state)
+{
+  switch (key)
+  {
+    case changes_option:
+      change_percent = parse_number(arg, 100);
+      break;
+    case depth_option:
+      depth = parse_number(arg, 1000);
+      break;
+    case documents_option:
+      document_count = parse_number(arg, 99999);
+      break;
+    case flat_option:
+      flat = true;
+      break;
+    case length_option:
+      paragraph_length = parse_number(arg, 1000000);
+      if (paragraph_length == 0)
+        paragraph_length = 1;
+      break;
+    case paragraphs_option:
+      paragraph_count = parse_number(arg, 100000000);
+      break;
+    case repeat_option:
+      repeat = parse_number(arg, 1000000);
+      break;
+    case seed_option:
+      seed = parse_number(arg, static_cast<unsigned long>(-1));
+      break;
+    case type_option:
+      if (std::strcmp(arg, "text") == 0)
+        kind = text_kind;
+      else if (std::strcmp(arg, "spreadsheet") == 0)
+        kind = spreadsheet_kind;
+      else if (std::strcmp(arg, "mixed") == 0)
+        kind = mixed_kind;
+      else
+      {
+        std::cerr << "Unknown type: " << arg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case unicode_option:
+      unicode_percent = parse_number(arg, 100);
+      break;
+    case ARGP_KEY_ARG:
+      if (directory != 0)
+        argp_usage(state); // does not return
+      directory = arg;
+      break;
+    case ARGP_KEY_FINI:
+      if (directory == 0)
+        argp_usage(state); // does not return
+      break;
+    case ARGP_KEY_INIT:
+    case ARGP_KEY_END:
+    case ARGP_KEY_SUCCESS:
+    case ARGP_KEY_NO_ARGS:
+      break;
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+} // end of namespace
+
+/** Generate the corpus.
+ * @param argc number of command line arguments
+ * @param argv the command line arguments
+ * @returns 0 for success, EXIT_FAILURE if anything goes wrong.
+ */
+int main(int argc, char *argv[])
+{
+  static argp_option options[] = {
+    { "changes",    changes_option, "PERCENT", 0, "give PERCENT of the paragraphs a tracked deletion (default 0)" },
+    { "depth",      depth_option, "N", 0, "nest the words of each paragraph in N levels of spans (default 1)" },
+    { "documents",  documents_option, "N", 0, "write N documents (default 10)" },
+    { "flat",       flat_option, 0, 0, "write flat documents, such as .fodt, instead of packages" },
+    { "length",     length_option, "N", 0, "give the paragraphs N words on average (default 12)" },
+    { "paragraphs", paragraphs_option, "N", 0, "write N paragraphs, or N spreadsheet cells, in each document (default 1000)" },
+    { "repeat",     repeat_option, "N", 0, "in spreadsheets, repeat every tenth row and every fifth cell N times (default 0, for none)" },
+    { "seed",       seed_option, "N", 0, "seed the random numbers with N; the same seed writes the same corpus (default 1)" },
+    { "type",       type_option, "TYPE", 0, "write text documents, spreadsheets, or both in turn (TYPE is text, spreadsheet, or mixed; default mixed)" },
+    { "unicode",    unicode_option, "PERCENT", 0, "make PERCENT of the words non-ASCII (default 10)" },
+    { 0 }
+  };
+  static argp parse_info = { options, parse_func, "DIRECTORY",
+    "Write a synthetic corpus of ODF documents to DIRECTORY, for benchmarks.\v"
+        "The documents depend only on the options, so the same options always "
+        "write the same corpus."
+  };
+
+  try {
+    argp_parse(&parse_info, argc, argv, 0, 0, 0);
+    if (mkdir(directory, 0777) != 0 and errno != EEXIST)
+    {
+      perror(directory);
+      return EXIT_FAILURE;
+    }
+    random_numbers random(seed);
+    for (unsigned long d = 0; d != document_count; ++d)
+      write_document(d, random);
+  } catch (std::exception& ex) {
+    std::cerr << ex.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -36,28 +36,47 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <deque>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <stack>
 #include <string>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 #include <boost/regex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "action.hpp"
+#include "arena.hpp"
+#include "mapped_file.hpp"
+#include "odf.hpp"
+#include "output.hpp"
+#include "progress.hpp"
+#include "scanner.hpp"
+#include "stats.hpp"
+#include "tar.hpp"
 #include "unicode.hpp"
 #include "xml.hpp"
 #include "zip.hpp"
 
 extern "C" {
 #include <argp.h>
+#include <fcntl.h>
 #include <libxml/parser.h>
+#include <sys/stat.h>
+#include <unistd.h>
 }
 
 namespace
@@ -65,205 +84,2292 @@ namespace
 
 enum exit_status { success, nomatch, io_error, cmdline_error };
 
+/// Keys for options that have only a long name.
+enum long_option {
+  aggregate_option = 256, arena_option, count_matches_option, extractor_option, format_option,
+  max_size_option, meta_field_option, meta_only_option, min_size_option, multiline_option, newer_than_option,
+  progress_option, progress_file_option, scope_option, slow_log_option, slow_threshold_option, stats_option,
+  stats_file_option, top_option, trace_option, type_option, window_option
+};
+
+/// How to find the paragraphs in a content stream.
+enum extractor_type {
+  dom_extractor,     ///< walk a libxml2 tree
+  reader_extractor,  ///< pull paragraphs from libxml2's xmlTextReader, skipping other subtrees
+  fast_extractor,    ///< use the ODF scanner, falling back to libxml2 for unusual streams
+  compare_extractors ///< run all of them and report any difference
+};
+
 enum when { never, always, multiple }; ///< When to print file names
 when print_filename = multiple; ///< When to print filenames
 bool have_documents = false; ///< True if at least one document has been processed
 bool have_pattern = false;   ///< True if the pattern has been specified on the command line
 bool search_meta = false;    ///< True means to search meta.xml in addition to content.xml
+bool search_content = true;  ///< False means to search only meta.xml, for --meta-only
+std::vector<odf::meta_field> meta_fields; ///< The metadata fields to search, or empty for all of them
+bool have_filters = false;   ///< True if any of --type, --newer-than, --min-size, or --max-size was given
+std::vector<std::string> types; ///< The media subtypes to search, from --type, or empty for all
+std::time_t newer_than = -1; ///< Search only documents saved after this time, or -1
+off_t min_size = 0;          ///< Search only documents of at least this many bytes
+off_t max_size = -1;         ///< Search only documents of at most this many bytes, or -1
+bool multiline = false;      ///< True means the pattern runs over the whole stream and can cross paragraphs
+std::size_t window_size = 4 << 20; ///< Longer paragraphs are matched in windows of this many characters
 bool invert = false;         ///< True means a match is when the regexp does NOT match the text
 bool search_deleted = false; ///< Search in deleted text, that is, inside \<deletion\> elements
+unsigned scope = odf::all_scope; ///< The structures to search, see odf::scope
+bool use_arena = false;      ///< Allocate each document from an arena, see arena.hpp
+bool show_stats = false;     ///< Print statistics to the standard error at exit
+stats::format stats_format = stats::text_format; ///< How to print the statistics, for --stats
+char const* stats_file = 0;  ///< Write the statistics to this file instead of the standard error, for --stats-file
+char const* trace_file = 0;  ///< Write a trace of the run to this file, for --trace
+char const* slow_log = 0;    ///< Record the slow documents in this file, for --slow-log
+unsigned progress_interval = 0; ///< Seconds between progress reports, or 0 for none, from --progress
+char const* progress_file = 0;  ///< Write the progress reports to this file instead of the standard error, for --progress-file
+int slow_log_fd = -1;        ///< The file descriptor of the --slow-log, or -1
+unsigned long slow_threshold = 1000; ///< A document is slow if it takes longer than this many milliseconds, from --slow-threshold
+extractor_type extractor = dom_extractor; ///< How to extract paragraphs from content.xml
+bool extractors_differ = false; ///< True if --extractor=compare found a difference
 long max_count = 0;          ///< Maximum number of matches per file
-long match_count;            ///< Number of matches in one file
+std::size_t before_context = 0; ///< Number of paragraphs to print before each match, from -B or -C
+std::size_t after_context = 0;  ///< Number of paragraphs to print after each match, from -A or -C
+__thread bool printed_group = false; ///< True after a group of context was printed for the document, on the calling thread
+__thread long match_count;   ///< Number of matches in one file, on the calling thread
 boost::regex_constants::syntax_option_type flags; ///< icase and other flags
 boost::regex_constants::syntax_option_type flavor = boost::regex_constants::grep; ///< Pattern type: perl, grep, egrep, or literal
 
-exit_status status = nomatch; ///< Exit status (set to success after any match)
+__thread exit_status status = nomatch; ///< Exit status (set to success after any match); each job has its own
+
+std::vector<std::string> documents; ///< list of documents to search
+
+boost::wregex pattern; ///< The regexp
+std::string pattern_text; ///< The regexp string from the command line
+std::auto_ptr<action> act; ///< The action to take when a match is found
+arena main_arena;          ///< Backs each document in arena mode, on the main thread
+__thread arena* document_arena = &main_arena; ///< Backs each document in arena mode, on the calling thread
+unsigned jobs = 1;         ///< Number of documents to search at once, from --jobs
+std::size_t top = 0;       ///< Number of keys that --aggregate prints, or 0 for all, and of documents that --slow-log summarizes, from --top
+bool want_positions = false; ///< True if the action prints the position of each match
+__thread std::string const* current_document = 0; ///< The document that the calling thread is searching
+__thread unsigned long long document_bytes = 0; ///< Bytes of XML in the document that the calling thread is searching, for --progress
+std::size_t const prefix_size = 4096; ///< Bytes at the start of a file that reveal its type
+std::size_t const min_window_size = 1024; ///< The smallest window that --window accepts
+zip_uint64_t const concurrent_streams_size = 4 << 20; ///< Search the streams of a package concurrently only if they hold more compressed bytes than this
+char const stdin_label[] = "(standard input)"; ///< The name of a document that is read from the standard input
+
+std::string const emptystr; ///< global empty string
+
+/** Read the pattern from a file.
+  * @param filename the name of the file to read
+  * @return the pattern, as read from @p filename
+  */
+std::string read_pattern(char const* filename)
+{
+  std::ifstream in(filename);
+  if (not in)
+  {
+    perror(filename);
+    std::exit(cmdline_error);
+  }
+  std::ostringstream out;
+  out << in.rdbuf();
+  std::string result = out.str();
+  // The newline at the end of the last line does not start another pattern.
+  if (not result.empty() and result[result.size() - 1] == '\n')
+    result.erase(result.size() - 1);
+  return result;
+}
+
+/** Turn a list of fixed strings, one per line, into an extended regular
+ * expression that matches any of them. A literal pattern would treat the
+ * whole list, newlines and all, as one string.
+ * @param text the strings, separated by newlines
+ * @return the alternatives, escaped and separated by newlines
+ */
+std::string fixed_strings(std::string const& text)
+{
+  std::string result;
+  result.reserve(text.size() + text.size() / 4);
+  for (std::string::const_iterator c = text.begin(); c != text.end(); ++c)
+  {
+    if (std::strchr("\\^$.|?*+()[]{}", *c) != 0)
+      result += '\\';
+    result += *c;
+  }
+  return result;
+}
+
+/** Convert a paragraph to UTF-32, timing the conversion for --stats.
+ * @param text the UTF-8 text
+ * @param size the number of bytes in @p text
+ * @return the UTF-32 text
+ */
+std::wstring widen(char const* text, std::size_t size)
+{
+  stats::timer timer(stats::convert_stage);
+  return utf8_to_utf32(text, size);
+}
+
+/** Convert a paragraph to UTF-32 in a buffer, timing the conversion for --stats.
+ * @param text the UTF-8 text
+ * @param size the number of bytes in @p text
+ * @param wide receives the UTF-32 text, and must have room for @p size characters
+ * @return the number of characters stored in @p wide
+ */
+std::size_t widen(char const* text, std::size_t size, wchar_t* wide)
+{
+  stats::timer timer(stats::convert_stage);
+  return utf8_to_utf32(text, size, wide);
+}
+
+/** Search a paragraph that is longer than the window, one window at a time.
+ * Each window of UTF-8 text is converted to UTF-32 and searched with
+ * match_partial. A partial match at the end of a window is carried into
+ * the next window, so a match that straddles two windows is found, as
+ * long as it is shorter than the window. The last character of each
+ * window is carried too, so that ^ and \\b see what precedes the next one.
+ * The UTF-32 copy never exceeds the window, however long the paragraph is.
+ * @param text the UTF-8 text to search
+ * @param size the number of bytes in @p text
+ * @return true if the pattern matches somewhere in @p text
+ */
+bool search_windowed(char const* text, std::size_t size)
+{
+  std::vector<wchar_t> window(window_size);
+  wchar_t* const buffer = &window[0];
+  std::size_t kept = 0;     // characters carried from the previous window
+  char const* next = text;  // the first byte that is not yet converted
+  char const* const end = text + size;
+  boost::match_results<wchar_t const*> m;
+  while (next != end)
+  {
+    // A partial match that nearly fills the window is dropped, to make room.
+    if (window.size() - kept < 4)
+    {
+      buffer[0] = buffer[kept - 1];
+      kept = 1;
+    }
+    std::size_t bytes = std::min<std::size_t>(end - next, window.size() - kept);
+    // Do not split a UTF-8 sequence between windows. A lead byte is at most
+    // three bytes back; if there is none, the whole chunk is converted, so
+    // that widen() reports the bad encoding.
+    if (next + bytes != end)
+    {
+      std::size_t back = 0;
+      while (back < 3 and back < bytes and (static_cast<unsigned char>(next[bytes - back]) & 0xC0) == 0x80)
+        ++back;
+      if (back < bytes and (static_cast<unsigned char>(next[bytes - back]) & 0xC0) != 0x80)
+        bytes -= back;
+    }
+    std::size_t const length = kept + widen(next, bytes, buffer + kept);
+    next += bytes;
+
+    // After the first window, buffer[0] is the context character.
+    wchar_t const* const start = buffer + (next - bytes == text ? 0 : 1);
+    boost::match_flag_type flags = boost::match_default | boost::match_partial;
+    if (start != buffer)
+      flags |= boost::match_prev_avail | boost::match_not_bob;
+    // Only the last window ends where the paragraph ends.
+    if (next != end)
+      flags |= boost::match_not_eol | boost::match_not_eow | boost::match_not_eob;
+    wchar_t const* const limit = buffer + length;
+    wchar_t const* carry = limit;
+    if (boost::regex_search(start, limit, m, pattern, flags))
+    {
+      if (m[0].matched)
+        return true;
+      // A partial match that fills the whole window cannot grow, so it is dropped.
+      if (m[0].first != start)
+        carry = m[0].first;
+    }
+    carry -= 1;
+    kept = limit - carry;
+    std::copy(carry, limit, buffer);
+  }
+  return false;
+}
+
+/** Search the text of one paragraph.
+ * A paragraph that is longer than the window is searched with
+ * search_windowed(). In arena mode, the UTF-32 copy of the paragraph goes in
+ * the arena's scratch buffer, which every paragraph of the document reuses.
+ * @param text the UTF-8 text to search
+ * @param size the number of bytes in @p text
+ * @return true if the pattern matches somewhere in @p text
+ */
+bool search(char const* text, std::size_t size)
+{
+  stats::timer timer(stats::match_stage);
+  if (size > window_size)
+    return search_windowed(text, size);
+  if (arena* a = arena::current())
+  {
+    wchar_t const* wide = a->scratch_array<wchar_t>(size);
+    wchar_t const* end = wide + widen(text, size, const_cast<wchar_t*>(wide));
+    return boost::regex_search(wide, end, pattern, boost::match_any);
+  }
+  return boost::regex_search(widen(text, size), pattern, boost::match_any);
+}
+
+/** Decorate a file name with a name, such as a stream or a spreadsheet cell.
+ * @param filename the file name, which is empty if file names are not printed
+ * @param name the decoration
+ * @return @p filename\<name\>, or just @p name if @p filename is empty
+ */
+std::string decorate(std::string const& filename, std::string const& name)
+{
+  if (name.empty())
+    return filename;
+  else if (filename.empty())
+    return name;
+  else
+    return filename + "<" + name + ">";
+}
+
+/** Decorate a file name with the position of a paragraph, such as a spreadsheet cell.
+ * @param filename the file name, which is empty if file names are not printed
+ * @param where the position of the paragraph
+ * @return @p filename\<position\>, or just the position if @p filename is empty
+ */
+std::string label(std::string const& filename, odf::location const& where)
+{
+  return decorate(filename, where.name());
+}
+
+/** Decorate a file name with the stream of a package that a match came from.
+ * Matches in content.xml carry the file name alone.
+ * @param filename the file name, which is empty if file names are not printed
+ * @param path the stream's path in the package, such as "styles.xml"
+ * @return the name to report with each match in the stream
+ */
+std::string stream_label(std::string const& filename, std::string const& path)
+{
+  return path == "content.xml" ? filename : decorate(filename, path);
+}
+
+/** Report a paragraph that matched.
+ * Perform the action, set the exit status to success, and increment
+ * the match count, unless the match count has reached the maximum.
+ * @param text the paragraph
+ * @param filename the name to report with the paragraph
+ * @param position where the paragraph was found, if the action prints positions, or null
+ * @return true to continue searching for matches or false to stop searching this file
+ */
+bool report(std::string const& text, std::string const& filename, match_position const* position = 0)
+{
+  bool result = true;
+  if (max_count == 0 or match_count != max_count)
+  {
+    stats::timer timer(stats::output_stage);
+    stats::add(stats::matches);
+    result = (position == 0 ? act->perform(text, filename) : act->perform(text, filename, *position));
+    status = success;
+    ++match_count;
+  }
+  return result;
+}
+
+/** Record where a paragraph was found, for an action that prints positions.
+ * @param position receives the position; its matches are left alone
+ * @param stream the stream's path in the package, or empty for a flat document
+ * @param paragraph the index of the paragraph in the stream
+ * @param location the position of the paragraph, such as a spreadsheet cell, or empty
+ */
+void locate_paragraph(match_position& position, std::string const& stream, unsigned long paragraph,
+                      std::string const& location)
+{
+  position.document = *current_document;
+  position.stream = stream;
+  position.location = location;
+  position.paragraph = paragraph;
+}
+
+/** Find every match in a paragraph, for an action that prints positions.
+ * The matches are found in one pass over the UTF-32 copy, and their
+ * offsets, which ascend, are converted to UTF-8 byte offsets in one
+ * more pass over the text, however many matches there are.
+ * With --invert-match, nothing is found.
+ * @param position receives the UTF-8 byte offsets of the matches
+ * @param text the UTF-8 paragraph
+ * @param size the number of bytes in @p text
+ * @return true if the pattern matched at least once
+ */
+bool locate_match(match_position& position, char const* text, std::size_t size)
+{
+  position.spans.clear();
+  if (invert)
+    return false;
+  stats::timer timer(stats::match_stage);
+  std::wstring const wide(widen(text, size));
+  std::vector<std::size_t> offsets;
+  typedef boost::regex_iterator<std::wstring::const_iterator> match_iterator;
+  for (match_iterator m(wide.begin(), wide.end(), pattern), end; m != end; ++m)
+  {
+    offsets.push_back(m->position());
+    offsets.push_back(m->position() + m->length());
+  }
+  utf32_to_utf8_offsets(text, size, offsets);
+  for (std::vector<std::size_t>::size_type i = 0; i != offsets.size(); i += 2)
+    position.spans.push_back(std::make_pair(offsets[i], offsets[i + 1]));
+  return not offsets.empty();
+}
+
+/** Test one paragraph for a match, and find the positions of the matches
+ * if the action prints them.
+ * Finding every match also tells whether there is one, so a paragraph
+ * that fits in the window is not searched a second time. A longer one
+ * is searched in windows first, so the whole of it is converted only if
+ * it matches.
+ * @param text the text to search
+ * @param size the number of bytes in @p text
+ * @param position receives the matches if the action prints positions
+ * @return true if the paragraph should be reported, taking --invert-match into account
+ */
+bool search(char const* text, std::size_t size, match_position& position)
+{
+  if (want_positions and not invert and size <= window_size)
+    return locate_match(position, text, size);
+  if (search(text, size) == invert)
+    return false;
+  if (want_positions)
+    locate_match(position, text, size);
+  return true;
+}
+
+/** Test one paragraph for a match.
+ * If the paragraph matches, perform the action, set the exit status to success,
+ * and increment the match count. The user can request that searching stop
+ * at a predetermined match count.
+ * @param text the text to search
+ * @param size the number of bytes in @p text
+ * @param filename the name of the file that contains the @p text
+ * @param where the position of the paragraph, which decorates @p filename, or null
+ * @param stream the stream's path in the package, or empty for a flat document
+ * @param paragraph the index of the paragraph in the stream
+ * @return true to continue searching for matches or false to stop searching this file
+ */
+bool match(char const* text, std::size_t size, std::string const& filename, odf::location const* where,
+           std::string const& stream, unsigned long paragraph)
+{
+  stats::paragraph(size);
+  match_position position;
+  if (not search(text, size, position))
+    return true;
+  if (want_positions)
+    locate_paragraph(position, stream, paragraph, where == 0 ? emptystr : where->name());
+  std::string const name(where == 0 ? filename : label(filename, *where));
+  return report(std::string(text, size), name, want_positions ? &position : 0);
+}
+
+/** A paragraph that matched in a stream that a worker thread searched,
+ * or a paragraph around one, for -A, -B, and -C.
+ */
+struct saved_match
+{
+  saved_match() : context(false), group(false) {}
+  std::string text;        ///< the paragraph
+  std::string label;       ///< the name to report, decorated with the stream and position
+  match_position position; ///< where the paragraph was found, if the action prints positions
+  bool context;            ///< true for a paragraph that is printed only because it is near a match
+  bool group;              ///< true if the paragraph starts a group of context
+};
+
+/// @return true if -A, -B, or -C asked for paragraphs around the matches
+inline bool has_context()
+{
+  return before_context != 0 or after_context != 0;
+}
+
+/** Print the separator before a group of context,
+ * unless it is the first group in the document.
+ */
+void start_group()
+{
+  if (printed_group)
+    act->separate();
+  printed_group = true;
+}
+
+/** Pass on the paragraphs of a stream that match, and the paragraphs
+ * around them for -A, -B, and -C.
+ * The last --before-context paragraphs that were not passed on are kept
+ * in a ring of slots. The strings in a slot are reused, so once they
+ * have grown to fit the paragraphs, keeping a paragraph costs no
+ * allocation. A paragraph is passed on once, even if it is near two
+ * matches, so context that overlaps is merged into one group.
+ * After --max-count matches, the paragraphs that follow the last one are
+ * passed on as context, even if they match, and then the ring asks to stop.
+ * Without context, only the matches are passed on.
+ */
+class context_ring
+{
+public:
+  context_ring()
+  : slots_(before_context), head_(0), kept_(0), index_(0), end_(0), after_(0), passed_(false)
+  {}
+  virtual ~context_ring() {}
+
+  /** Take the next paragraph of the stream.
+   * @param text the paragraph
+   * @param size the number of bytes in @p text
+   * @param location the position of the paragraph, such as a spreadsheet cell, or empty
+   * @param position where the matches are, if the action prints positions, or null
+   * @param matched true if the paragraph matched, taking --invert-match into account
+   * @return false to stop searching the document
+   */
+  bool next(char const* text, std::size_t size, std::string const& location,
+            match_position const* position, bool matched)
+  {
+    std::size_t const index = index_++;
+    if (matched and not full())
+    {
+      bool group = has_context() and (not passed_ or index - kept_ != end_);
+      for (; kept_ != 0; --kept_)
+      {
+        slot const& s = slots_[(head_ + slots_.size() - kept_) % slots_.size()];
+        if (not pass(s.text.data(), s.text.size(), s.location, 0, true, group))
+          return false;
+        group = false;
+      }
+      bool const more = pass(text, size, location, position, false, group);
+      end_ = index + 1;
+      after_ = after_context;
+      passed_ = true;
+      return more and not (full() and after_ == 0);
+    }
+    if (after_ != 0)
+    {
+      --after_;
+      end_ = index + 1;
+      return pass(text, size, location, 0, true, false) and not (full() and after_ == 0);
+    }
+    if (full())
+      return false;
+    if (not slots_.empty())
+    {
+      slot& s = slots_[head_];
+      s.text.assign(text, size);
+      s.location = location;
+      head_ = (head_ + 1) % slots_.size();
+      kept_ = std::min(kept_ + 1, slots_.size());
+    }
+    return true;
+  }
+
+protected:
+  /** Pass on a paragraph.
+   * @param text the paragraph
+   * @param size the number of bytes in @p text
+   * @param location the position of the paragraph, or empty
+   * @param position where the matches are, or null
+   * @param context true for a paragraph that is near a match but is not one
+   * @param group true if the paragraph starts a group of context
+   * @return false to stop searching the document
+   */
+  virtual bool pass(char const* text, std::size_t size, std::string const& location,
+                    match_position const* position, bool context, bool group) = 0;
+  /// @return true after --max-count matches have been passed on
+  virtual bool full() const = 0;
+
+private:
+  /// A paragraph before the next match.
+  struct slot
+  {
+    std::string text;     ///< the paragraph
+    std::string location; ///< its position, or empty
+  };
+
+  context_ring(context_ring const&);   ///< not implemented
+  void operator=(context_ring const&); ///< not implemented
+
+  std::vector<slot> slots_; ///< the ring, with room for --before-context paragraphs
+  std::size_t head_;        ///< the slot for the next paragraph that is kept
+  std::size_t kept_;        ///< the number of slots in use, which end just before @c head_
+  std::size_t index_;       ///< the index of the next paragraph
+  std::size_t end_;         ///< the index after the last paragraph that was passed on
+  std::size_t after_;       ///< the number of paragraphs of context still to pass on
+  bool passed_;             ///< true after any paragraph was passed on
+};
+
+/** Report the matches in a stream, and print their context, as they are found.
+ */
+class context_printer : public context_ring
+{
+public:
+  /// @param filename the name to report with each match
+  context_printer(std::string const& filename) : filename_(filename) {}
+
+protected:
+  virtual bool pass(char const* text, std::size_t size, std::string const& location,
+                    match_position const* position, bool context, bool group)
+  {
+    if (group)
+      start_group();
+    std::string const name(decorate(filename_, location));
+    if (not context)
+      return report(std::string(text, size), name, position);
+    stats::timer timer(stats::output_stage);
+    act->context(std::string(text, size), name);
+    return true;
+  }
+  virtual bool full() const
+  {
+    return max_count != 0 and match_count == max_count;
+  }
+
+private:
+  std::string const& filename_; ///< the name to report with each match
+};
+
+/** Save the matches in a stream, and their context, for a worker thread
+ * or for --multiline. The main thread reports the saved matches with
+ * report_saved() after the worker is done, so the output is the same as
+ * if the streams were searched one by one. At most --max-count matches
+ * are saved.
+ */
+class context_saver : public context_ring
+{
+public:
+  /// @param filename the name to report with each match
+  /// @param matches receives the matches and their context, in document order
+  context_saver(std::string const& filename, std::vector<saved_match>& matches)
+  : filename_(filename), matches_(matches), count_(0)
+  {}
+
+protected:
+  virtual bool pass(char const* text, std::size_t size, std::string const& location,
+                    match_position const* position, bool context, bool group)
+  {
+    matches_.push_back(saved_match());
+    saved_match& saved = matches_.back();
+    saved.text.assign(text, size);
+    saved.label = decorate(filename_, location);
+    if (position != 0)
+      saved.position = *position;
+    saved.context = context;
+    saved.group = group;
+    if (not context)
+      ++count_;
+    return true;
+  }
+  virtual bool full() const
+  {
+    return max_count != 0 and count_ == static_cast<unsigned long>(max_count);
+  }
+
+private:
+  std::string const& filename_;       ///< the name to report with each match
+  std::vector<saved_match>& matches_; ///< the matches and their context
+  unsigned long count_;               ///< the number of matches saved
+};
+
+/** Report what a context_saver saved.
+ * Once --max-count matches have been reported for the document, which
+ * can happen in an earlier stream, a group that starts later is not printed.
+ * @param matches the saved matches and their context
+ * @return false to stop searching the document
+ */
+bool report_saved(std::vector<saved_match> const& matches)
+{
+  for (std::vector<saved_match>::const_iterator m = matches.begin(); m != matches.end(); ++m)
+  {
+    if (m->group)
+    {
+      if (max_count != 0 and match_count == max_count)
+        return false;
+      start_group();
+    }
+    if (m->context)
+    {
+      stats::timer timer(stats::output_stage);
+      act->context(m->text, m->label);
+    }
+    else if (not report(m->text, m->label, want_positions ? &m->position : 0))
+      return false;
+  }
+  return true;
+}
+
+/** Match each paragraph that an extractor finds, and pass the
+ * paragraphs to a context_ring, which decides what to print.
+ */
+struct match_sink : odf::paragraph_sink
+{
+  /// @param stream the stream's path in the package, or empty for a flat document
+  /// @param ring receives each paragraph
+  match_sink(std::string const& stream, context_ring& ring)
+  : stream_(stream), ring_(ring), paragraph_(0), more_(true)
+  {}
+  virtual bool paragraph(char const* text, std::size_t size)
+  {
+    unsigned long const paragraph = paragraph_++;
+    stats::paragraph(size);
+    match_position position;
+    bool const matched = search(text, size, position);
+    // The position is named only if the paragraph might be printed.
+    std::string const location(where() != 0 and (matched or has_context()) ? where()->name() : std::string());
+    if (matched and want_positions)
+      locate_paragraph(position, stream_, paragraph, location);
+    return more_ = ring_.next(text, size, location, want_positions ? &position : 0, matched);
+  }
+  std::string const& stream_;   ///< the stream, for the position of each match
+  context_ring& ring_;          ///< decides which paragraphs to print
+  unsigned long paragraph_;     ///< the index of the next paragraph
+  bool more_;                   ///< false after the action asked to stop
+};
+
+/** Collect the paragraphs of a stream in one buffer, for --multiline.
+ * The paragraphs are converted to UTF-32 once and joined by newlines,
+ * and the pattern runs over the whole buffer, so a match can cross a
+ * paragraph break, and the regex engine is started once per match instead
+ * of once per paragraph. Offset tables map each match back to the
+ * paragraphs that it touches.
+ */
+class document_buffer : public odf::paragraph_sink
+{
+public:
+  virtual bool paragraph(char const* text, std::size_t size)
+  {
+    stats::paragraph(size);
+    text_starts_.push_back(text_.size());
+    wide_starts_.push_back(wide_.size());
+    locations_.push_back(where() == 0 ? emptystr : where()->name());
+    text_.append(text, size);
+    wide_.resize(wide_.size() + size + 1);
+    wchar_t* const wide = &wide_[wide_starts_.back()];
+    std::size_t const length = widen(text, size, wide);
+    wide[length] = L'\n';
+    wide_.resize(wide_starts_.back() + length + 1);
+    return true;
+  }
+
+  /** Search the buffer and save the paragraphs that match.
+   * Every paragraph that a match touches is saved once, in document order.
+   * With --invert-match, the paragraphs that no match touches are saved.
+   * If the action prints positions, the search goes on after each match
+   * instead of skipping to the next paragraph, so a paragraph gets every
+   * match that touches it. With -A, -B, or -C, the paragraphs are passed
+   * through a context_saver afterward, which adds their context.
+   * @param filename the name to report with each match
+   * @param stream the stream's path in the package, or empty for a flat document
+   * @param matches receives the matches, at most --max-count of them, and their context
+   */
+  void search(std::string const& filename, std::string const& stream, std::vector<saved_match>& matches) const
+  {
+    std::vector<saved_match> found;
+    std::vector<saved_match>& target = (has_context() ? found : matches);
+    std::vector<saved_match>::size_type const saved = target.size();
+    std::vector<std::size_t> indexes;
+    find(filename, stream, target, indexes);
+    if (want_positions and not invert)
+      for (std::vector<saved_match>::size_type i = saved; i != target.size(); ++i)
+        to_utf8(target[i]);
+    if (not has_context())
+      return;
+
+    context_saver saver(filename, matches);
+    std::vector<std::size_t>::size_type k = 0; // the next match in @c found
+    for (std::size_t p = 0; p != text_starts_.size(); ++p)
+    {
+      bool const matched = (k != indexes.size() and indexes[k] == p);
+      if (not saver.next(text_.data() + text_starts_[p], text_end(p) - text_starts_[p], locations_[p],
+                         matched and want_positions ? &found[k].position : 0, matched))
+        break;
+      if (matched)
+        ++k;
+    }
+  }
+
+private:
+  /// Save the paragraphs that match, with the UTF-32 offsets of the matches. See search().
+  /// @param indexes receives the index of each paragraph that is saved
+  void find(std::string const& filename, std::string const& stream, std::vector<saved_match>& matches,
+            std::vector<std::size_t>& indexes) const
+  {
+    std::size_t const count = text_starts_.size();
+    std::size_t next = 0; // the first paragraph that is neither saved nor passed over
+    std::size_t from = 0; // where the next search starts in the UTF-32 buffer
+    bool const every_match = want_positions and not invert;
+    stats::timer timer(stats::match_stage);
+    if (count != 0)
+    {
+      wchar_t const* const begin = &wide_[0];
+      wchar_t const* const end = begin + wide_.size();
+      boost::match_results<wchar_t const*> m;
+      boost::match_flag_type flags = boost::match_default;
+      while (from < wide_.size() and boost::regex_search(begin + from, end, m, pattern, flags))
+      {
+        std::size_t const start = m[0].first - begin;
+        std::size_t const end = m[0].second - begin;
+        std::size_t const first = paragraph_at(start);
+        std::size_t const last = (end == start ? first : paragraph_at(end - 1));
+        for (std::size_t p = (invert ? next : first); p != (invert ? first : last + 1); ++p)
+          if (p < next)
+            add_span(p, matches.back(), start, end); // the paragraph was saved for an earlier match
+          else if (not save(p, filename, stream, matches, indexes, start, end))
+            return;
+        next = last + 1;
+        if (every_match)
+          from = (end == start ? end + 1 : end);
+        else
+          from = (next == count ? wide_.size() : wide_starts_[next]);
+        // The next search can look back, so ^ and \b work at its start.
+        flags = boost::match_prev_avail;
+      }
+    }
+    if (invert)
+      for (; next != count; ++next)
+        if (not save(next, filename, stream, matches, indexes, 0, 0))
+          return;
+  }
+
+  /// @return the offset of the end of a paragraph in the UTF-8 buffer
+  std::size_t text_end(std::size_t p) const
+  {
+    return p + 1 == text_starts_.size() ? text_.size() : text_starts_[p + 1];
+  }
+
+  /// @return the index of the paragraph that holds an offset in the UTF-32 buffer
+  std::size_t paragraph_at(std::size_t offset) const
+  {
+    return std::upper_bound(wide_starts_.begin(), wide_starts_.end(), offset) - wide_starts_.begin() - 1;
+  }
+
+  /** Save one paragraph.
+   * The position of the match is the part of it that falls in the paragraph.
+   * @param p the index of the paragraph
+   * @param filename the name to report with the paragraph
+   * @param stream the stream's path in the package, or empty for a flat document
+   * @param matches receives the paragraph
+   * @param indexes receives @p p
+   * @param start the offset of the match in the UTF-32 buffer
+   * @param end the offset of the end of the match in the UTF-32 buffer
+   * @return false if --max-count matches have been saved
+   */
+  bool save(std::size_t p, std::string const& filename, std::string const& stream,
+            std::vector<saved_match>& matches, std::vector<std::size_t>& indexes,
+            std::size_t start, std::size_t end) const
+  {
+    indexes.push_back(p);
+    matches.push_back(saved_match());
+    saved_match& saved = matches.back();
+    saved.text.assign(text_, text_starts_[p], text_end(p) - text_starts_[p]);
+    saved.label = (locations_[p].empty() ? filename : decorate(filename, locations_[p]));
+    if (want_positions)
+    {
+      locate_paragraph(saved.position, stream, p, locations_[p]);
+      if (not invert)
+        add_span(p, saved, start, end);
+    }
+    return max_count == 0 or matches.size() < static_cast<unsigned long>(max_count);
+  }
+
+  /** Add the part of a match that falls in a paragraph to the paragraph's position.
+   * The span is in UTF-32 offsets until to_utf8() converts all the spans
+   * of the paragraph at once.
+   * @param p the index of the paragraph
+   * @param saved the saved paragraph
+   * @param start the offset of the match in the UTF-32 buffer
+   * @param end the offset of the end of the match in the UTF-32 buffer
+   */
+  void add_span(std::size_t p, saved_match& saved, std::size_t start, std::size_t end) const
+  {
+    // Clip the match to the paragraph, without its newline.
+    std::size_t const wide_end = (p + 1 == wide_starts_.size() ? wide_.size() : wide_starts_[p + 1]) - 1;
+    saved.position.spans.push_back(std::make_pair(std::max(start, wide_starts_[p]) - wide_starts_[p],
+                                                  std::max(std::min(end, wide_end), wide_starts_[p]) - wide_starts_[p]));
+  }
+
+  /// Convert the spans of a saved paragraph from UTF-32 offsets to UTF-8 byte offsets.
+  static void to_utf8(saved_match& saved)
+  {
+    std::vector<std::pair<std::size_t, std::size_t> >& spans = saved.position.spans;
+    std::vector<std::size_t> offsets;
+    offsets.reserve(2 * spans.size());
+    for (std::vector<std::pair<std::size_t, std::size_t> >::size_type i = 0; i != spans.size(); ++i)
+    {
+      offsets.push_back(spans[i].first);
+      offsets.push_back(spans[i].second);
+    }
+    utf32_to_utf8_offsets(saved.text.data(), saved.text.size(), offsets);
+    for (std::vector<std::pair<std::size_t, std::size_t> >::size_type i = 0; i != spans.size(); ++i)
+      spans[i] = std::make_pair(offsets[2 * i], offsets[2 * i + 1]);
+  }
+
+  std::string text_;                     ///< the paragraphs, in UTF-8, one after another
+  std::vector<wchar_t> wide_;            ///< the paragraphs, in UTF-32, each followed by a newline
+  std::vector<std::size_t> text_starts_; ///< the offset of each paragraph in @c text_
+  std::vector<std::size_t> wide_starts_; ///< the offset of each paragraph in @c wide_
+  std::vector<std::string> locations_;   ///< the position of each paragraph, or empty
+};
+
+/** Save the paragraphs that an extractor finds, for --extractor=compare.
+ */
+struct collect_sink : odf::paragraph_sink
+{
+  virtual bool paragraph(char const* text, std::size_t size)
+  {
+    paragraphs_.push_back(std::string(text, size));
+    locations_.push_back(where() == 0 ? emptystr : where()->name());
+    return true;
+  }
+  std::vector<std::string> paragraphs_; ///< the paragraphs, in document order
+  std::vector<std::string> locations_;  ///< the position of each paragraph
+};
+
+/** A position whose name was saved, to replay collected paragraphs.
+ */
+struct saved_location : odf::location
+{
+  virtual std::string name() const { return name_; }
+  std::string name_; ///< the saved name
+};
+
+/** The attributes of the reader's current element, for the selector.
+ */
+struct reader_attributes : odf::attributes
+{
+  /// @param reader the reader, positioned on an element
+  reader_attributes(xml::reader const& reader) : reader_(reader) {}
+  virtual bool get(odf::ns uri, char const* local_name, std::string& value) const
+  {
+    return reader_.attribute(local_name, odf::uri_of(uri), value);
+  }
+  xml::reader const& reader_; ///< the reader
+};
+
+/** Extract the paragraphs of a content or styles stream with a libxml2 tree.
+ * @param text the contents of the stream
+ * @param size the number of bytes in @p text
+ * @param name the name of the stream, for error messages
+ * @param sink receives each paragraph
+ */
+void extract_dom(char const* text, std::size_t size, std::string const& name, odf::paragraph_sink& sink)
+{
+  xml::doc doc;
+  {
+    stats::timer timer(stats::parse_stage);
+    if (not doc.parse(text, size))
+      throw std::runtime_error(name + ": cannot parse XML");
+  }
+  odf::vocabulary names(doc);
+  for (xmlNode* node = doc.get_root_element()->children ; node != 0; node = node->next)
+  {
+    odf::element const kind = names.classify(node);
+    if (kind == odf::office_master_styles)
+    {
+      // The page headers and footers, in styles.xml or a flat document
+      odf::selector select(scope, search_deleted);
+      select.begin(kind);
+      if (not odf::grep_node(node, names, select, sink))
+        return;
+    }
+    else if (kind == odf::office_body)
+    {
+      odf::grep_body(node, names, scope, search_deleted, sink);
+      break;
+    }
+  }
+}
+
+/** Extract the paragraphs of a content or styles stream with libxml2's pull parser.
+ * The reader visits, node by node, only the path from the root to
+ * \<office:master-styles\> and \<office:text\> and the contents of paragraphs. Everything else, such as
+ * automatic styles, font declarations, forms, embedded binary data,
+ * deleted text, and paragraphs outside the --scope, is skipped with
+ * xmlTextReaderNext without being built into a tree. Text is copied only
+ * while inside a paragraph.
+ * @param text the contents of the stream
+ * @param size the number of bytes in @p text
+ * @param name the name of the stream, for error messages
+ * @param sink receives each paragraph
+ */
+void extract_reader(char const* text, std::size_t size, std::string const& name, odf::paragraph_sink& sink)
+{
+  // The reader frees each node as it moves on, so in arena mode its
+  // allocations stay on the heap and the document is streamed in bounded memory.
+  arena::suspend heap;
+  // A paragraph can be hundreds of megabytes, more than libxml2 allows by default.
+  xml::reader reader(text, size, name.c_str(), XML_PARSE_HUGE);
+  if (not reader)
+    throw std::runtime_error(name + ": cannot parse XML");
+
+  odf::vocabulary names(reader);
+  odf::selector select(scope, search_deleted);
+  std::string paragraph;       // text of the current paragraph
+  int paragraph_depth = -1;    // depth of the current paragraph, or -1
+  int text_depth = -1;         // depth of the body or master styles being searched, or -1
+  bool body_seen = false;      // only the first <office:body> is searched
+  bool text_seen = false;      // only the first body, such as <office:text>, is searched
+  int result = reader.read();
+  while (result == 1)
+  {
+    int const type = reader.type();
+    int const depth = reader.depth();
+    if (paragraph_depth >= 0)
+    {
+      if (type == xml::reader::text or
+          type == xml::reader::whitespace or type == xml::reader::significant_whitespace)
+        paragraph.append(xml::charptr(reader.value()));
+      else if (type == xml::reader::cdata)
+      {
+        // The reader does not normalize line ends in CDATA sections.
+        for (char const* c = xml::charptr(reader.value()); *c != '\0'; ++c)
+          if (*c != '\r')
+            paragraph += *c;
+          else if (c[1] != '\n')
+            paragraph += '\n';
+      }
+      else if (type == xml::reader::end_element and depth == paragraph_depth)
+      {
+        paragraph_depth = -1;
+        if (not sink.paragraph(paragraph.data(), paragraph.size()))
+        {
+          sink.locate(0);
+          return;
+        }
+        paragraph.clear();
+      }
+    }
+    else if (type == xml::reader::end_element)
+    {
+      if (text_depth >= 0 and depth > text_depth)
+        select.leave();
+      else if (text_depth == 1)
+        text_depth = -1; // the end of <office:master-styles>; the body may follow
+      else
+        break; // the end of <office:text> or <office:body>
+    }
+    else if (type == xml::reader::element)
+    {
+      odf::element const kind = names.classify(reader.local_name(), reader.namespace_uri());
+      bool descend = true;
+      if (depth == 1 and kind == odf::office_master_styles)
+      {
+        if ((descend = not reader.is_empty_element()))
+        {
+          text_depth = depth;
+          select.begin(kind);
+          sink.locate(select.where());
+        }
+      }
+      else if (depth == 1)
+        body_seen |= descend = (not body_seen and kind == odf::office_body);
+      else if (depth == 2 and text_depth < 0)
+      {
+        text_seen |= descend = (not text_seen and odf::is_body(kind));
+        if (descend)
+        {
+          text_depth = depth;
+          select.begin(kind);
+          sink.locate(select.where());
+        }
+      }
+      else if (text_depth >= 0)
+        switch (select.enter(kind, reader_attributes(reader)))
+        {
+          case odf::extract:
+            if (not reader.is_empty_element())
+              paragraph_depth = depth;
+            else if (not sink.paragraph("", 0))
+            {
+              sink.locate(0);
+              return;
+            }
+            break;
+          case odf::skip:
+            descend = false;
+            break;
+          case odf::descend:
+            if (reader.is_empty_element())
+              select.leave();
+            break;
+        }
+
+      if (not descend)
+      {
+        result = reader.next();
+        continue;
+      }
+    }
+    result = reader.read();
+  }
+  sink.locate(0);
+  if (result < 0)
+    throw std::runtime_error(name + ": cannot parse XML");
+}
+
+/** Extract the paragraphs of a content stream with the ODF scanner.
+ * Streams that the scanner does not handle are passed to libxml2.
+ * @param text the contents of the stream
+ * @param size the number of bytes in @p text
+ * @param name the name of the stream, for error messages
+ * @param sink receives each paragraph
+ */
+void extract_fast(char const* text, std::size_t size, std::string const& name, odf::paragraph_sink& sink)
+{
+  odf::scanner scanner(scope, search_deleted);
+  try
+  {
+    scanner.scan(text, size, sink);
+  }
+  catch (odf::scanner::unsupported&)
+  {
+    extract_dom(text, size, name, sink);
+  }
+  catch (std::runtime_error& ex)
+  {
+    throw std::runtime_error(name + ": " + ex.what());
+  }
+}
+
+/** Compare the paragraphs from an extractor with the paragraphs from the libxml2 tree.
+ * Report the first difference on the standard error.
+ * @param expected the paragraphs from extract_dom
+ * @param actual the paragraphs from another extractor
+ * @param extractor the name of the other extractor
+ * @param name the name of the stream
+ */
+void compare_paragraphs(collect_sink const& expected, collect_sink const& actual,
+                        char const* extractor, std::string const& name)
+{
+  std::vector<std::string>::size_type n = 0;
+  while (n != expected.paragraphs_.size() and n != actual.paragraphs_.size() and
+         expected.paragraphs_[n] == actual.paragraphs_[n] and expected.locations_[n] == actual.locations_[n])
+    ++n;
+  if (n != expected.paragraphs_.size() or n != actual.paragraphs_.size())
+  {
+    std::cerr << name << ": extractors differ at paragraph " << n + 1 << " of "
+              << expected.paragraphs_.size() << " (dom) and " << actual.paragraphs_.size()
+              << " (" << extractor << ")\n";
+    extractors_differ = true;
+  }
+}
+
+/** Extract the paragraphs of a content stream every way and compare them.
+ * Any difference is reported on the standard error, and the program
+ * exits with an error status. The paragraphs from the libxml2 tree are
+ * the ones that are passed on to @p sink.
+ * @param text the contents of the stream
+ * @param size the number of bytes in @p text
+ * @param name the name of the stream, for error messages
+ * @param sink receives each paragraph
+ */
+void extract_compare(char const* text, std::size_t size, std::string const& name, odf::paragraph_sink& sink)
+{
+  collect_sink dom, reader, fast;
+  extract_dom(text, size, name, dom);
+  extract_reader(text, size, name, reader);
+  compare_paragraphs(dom, reader, "reader", name);
+  extract_fast(text, size, name, fast);
+  compare_paragraphs(dom, fast, "fast", name);
+
+  saved_location where;
+  sink.locate(&where);
+  for (std::vector<std::string>::size_type n = 0; n != dom.paragraphs_.size(); ++n)
+  {
+    where.name_ = dom.locations_[n];
+    if (not sink.paragraph(dom.paragraphs_[n].data(), dom.paragraphs_[n].size()))
+      break;
+  }
+  sink.locate(0);
+}
+
+/** Extract the paragraphs of a stream with one of the extractors.
+ * @param how the extractor to use
+ * @param text the contents of the stream
+ * @param size the number of bytes in @p text
+ * @param name the name of the stream, for error messages
+ * @param sink receives each paragraph
+ */
+void run_extractor(extractor_type how, char const* text, std::size_t size, std::string const& name,
+                   odf::paragraph_sink& sink)
+{
+  stats::timer timer(stats::extract_stage);
+  switch (how)
+  {
+    case dom_extractor:
+      extract_dom(text, size, name, sink);
+      break;
+    case reader_extractor:
+      extract_reader(text, size, name, sink);
+      break;
+    case fast_extractor:
+      extract_fast(text, size, name, sink);
+      break;
+    case compare_extractors:
+      extract_compare(text, size, name, sink);
+      break;
+  }
+}
+
+/** Grep the paragraphs of a content stream.
+ * All ODF documents have \<document-content\> (or, for a flat document,
+ * \<document\>) as the root element. Text documents can contain scripts
+ * and whatnot, and the body of the document is contained in the \<body\>
+ * element. It contains styles and whatnot, and the main text
+ * is found in the \<text\> element. The page headers and footers are
+ * in \<master-styles\>, in styles.xml or a flat document.
+ * @param text the contents of the stream
+ * @param size the number of bytes in @p text
+ * @param name the name of the stream, for error messages
+ * @param stream the stream's path in the package, or empty for a flat document
+ * @param filename the document filename
+ * @param how the extractor to use
+ * @return true to keep searching this document
+ */
+bool grep_stream(char const* text, std::size_t size, std::string const& name,
+                 std::string const& stream, std::string const& filename, extractor_type how)
+{
+  if (multiline)
+  {
+    document_buffer buffer;
+    run_extractor(how, text, size, name, buffer);
+    std::vector<saved_match> matches;
+    buffer.search(filename, stream, matches);
+    return report_saved(matches);
+  }
+  context_printer printer(filename);
+  match_sink sink(stream, printer);
+  run_extractor(how, text, size, name, sink);
+  return sink.more_;
+}
+
+/** Read the whole of a stream in a package, counting its bytes for --stats and --progress.
+ * @param file the stream
+ * @return the inflated contents of the stream
+ */
+std::string inflate(Zip::File& file)
+{
+  stats::timer timer(stats::inflate_stage);
+  std::string text(file.read());
+  document_bytes += text.size();
+  if (stats::enabled())
+  {
+    stats::add(stats::compressed_bytes, file.compressed_size());
+    stats::add(stats::inflated_bytes, text.size());
+  }
+  return text;
+}
+
+/** Grep a content stream in a document.
+ * Extract the text, one paragraph at a time,
+ * and match the pattern against the paragraph.
+ * @param file the stream in the document
+ * @param filename the document filename
+ * @param how the extractor to use
+ * @return true to keep searching this document
+ */
+bool grep_content(Zip::File& file, std::string filename, extractor_type how)
+{
+  std::string text(inflate(file));
+  return grep_stream(text.data(), text.size(), file.pathname(), file.filename(), filename, how);
+}
+
+/** Test whether a metadata field was named by --meta-field.
+ * @param wanted the interned namespace URI and local name of each field;
+ * a null URI matches any namespace
+ * @param local_name the interned local name of the field
+ * @param uri the interned namespace URI of the field
+ * @return true if the field is in @p wanted
+ */
+bool is_wanted(std::vector<std::pair<xmlChar const*, xmlChar const*> > const& wanted,
+               xmlChar const* local_name, xmlChar const* uri)
+{
+  for (std::vector<std::pair<xmlChar const*, xmlChar const*> >::const_iterator w = wanted.begin(); w != wanted.end(); ++w)
+    if (w->second == local_name and (w->first == 0 or w->first == uri))
+      return true;
+  return false;
+}
+
+/** Grep the metadata fields of a stream with the pull parser.
+ * The fields are the children of \<office:meta\>, which is a child of
+ * the root element in both meta.xml and a flat document. Nothing after
+ * \<office:meta\> is read. The field's local name, such as "creator",
+ * decorates the file name of each match. If --meta-field was given,
+ * the other fields are skipped.
+ * @param text the contents of the stream
+ * @param size the number of bytes in @p text
+ * @param name the name of the stream, for error messages
+ * @param stream the stream's path in the package, or empty for a flat document
+ * @param filename the document filename
+ * @return true to keep searching this document
+ */
+bool grep_meta_fields(char const* text, std::size_t size, std::string const& name,
+                      std::string const& stream, std::string const& filename)
+{
+  stats::timer timer(stats::extract_stage);
+  xml::reader reader(text, size, name.c_str());
+  if (not reader)
+    throw std::runtime_error(name + ": cannot parse XML");
+  odf::vocabulary names(reader);
+  std::vector<std::pair<xmlChar const*, xmlChar const*> > wanted; // --meta-field, interned
+  for (std::vector<odf::meta_field>::const_iterator f = meta_fields.begin(); f != meta_fields.end(); ++f)
+    wanted.push_back(std::make_pair(f->uri == 0 ? 0 : reader.intern(f->uri), reader.intern(f->local_name.c_str())));
+  saved_location field;   // the name of the current field
+  std::string value;      // the text of the current field
+  unsigned long index = 0; // the index of the current field, which stands for a paragraph
+  int result = reader.read();
+  while (result == 1)
+  {
+    int const type = reader.type();
+    int const depth = reader.depth();
+    if (type == xml::reader::element and depth == 1)
+    {
+      if (names.classify(reader.local_name(), reader.namespace_uri()) != odf::office_meta)
+      {
+        result = reader.next();
+        continue;
+      }
+    }
+    else if (type == xml::reader::element and depth == 2)
+    {
+      if (not wanted.empty() and not is_wanted(wanted, reader.local_name(), reader.namespace_uri()))
+      {
+        result = reader.next();
+        continue;
+      }
+      field.name_ = xml::charptr(reader.local_name());
+      value.clear();
+      if (reader.is_empty_element() and not match(value.data(), value.size(), filename, &field, stream, index++))
+        return false;
+    }
+    else if (type == xml::reader::text or type == xml::reader::cdata or
+             type == xml::reader::whitespace or type == xml::reader::significant_whitespace)
+      value.append(xml::charptr(reader.value()));
+    else if (type == xml::reader::end_element and depth == 2)
+    {
+      if (not match(value.data(), value.size(), filename, &field, stream, index++))
+        return false;
+    }
+    else if (type == xml::reader::end_element and depth == 1)
+      break; // the end of <office:meta>
+    result = reader.read();
+  }
+  if (result < 0)
+    throw std::runtime_error(name + ": cannot parse XML");
+  return true;
+}
+
+/** Grep the meta.xml stream of a package.
+ * meta.xml is optional, so a package without one has nothing to search.
+ * @param zip the package
+ * @param filename the document filename
+ * @return true to keep searching this document
+ */
+bool grep_meta(Zip::Archive& zip, std::string const& filename)
+{
+  if (zip.locate("meta.xml") < 0)
+    return true;
+  Zip::File file(zip, "meta.xml");
+  std::string const text(inflate(file));
+  return grep_meta_fields(text.data(), text.size(), file.pathname(), file.filename(), filename);
+}
+
+/** Where a document comes from: a file of its own, or a buffer in
+ * memory, such as a member of a bundle.
+ */
+struct document_source
+{
+  /// A document in a file.
+  /// @param path the path to the file
+  /// @param flat true for a flat document
+  document_source(std::string const& path, bool flat)
+  : name(path), data(0), size(0), flat(flat)
+  {}
+  /// A document in memory.
+  /// @param label the name of the document, such as bundle.tar!doc.odt
+  /// @param contents the document, which must outlive this object
+  /// @param flat true for a flat document
+  document_source(std::string const& label, std::string const& contents, bool flat)
+  : name(label), data(contents.data()), size(contents.size()), flat(flat)
+  {}
+
+  /// Open the document as a ZIP package.
+  /// @return a new archive, which the caller must delete
+  Zip::Archive* open() const
+  {
+    stats::timer timer(stats::open_stage);
+    return data == 0 ? new Zip::Archive(name) : new Zip::Archive(data, size, name);
+  }
+
+  std::string name;   ///< the path to the file, or the label of a document in memory
+  char const* data;   ///< the document in memory, or null to read the file
+  std::size_t size;   ///< the number of bytes at @c data
+  bool flat;          ///< true for a flat document, false for a package
+};
+
+/** Grep a flat ODF document, such as a .fodt file.
+ * A file is mapped into memory and passed straight to the extractor,
+ * so even a file of several gigabytes is never copied. The metadata and
+ * the body come from the same stream. A flat file can be any size, so it
+ * is never parsed into a tree unless --extractor=compare asks for one.
+ * @param document the document
+ * @param filename the document filename to print
+ */
+void grep_flat(document_source const& document, std::string const& filename)
+{
+  std::auto_ptr<mapped_file> file;
+  if (document.data == 0)
+  {
+    stats::timer timer(stats::open_stage);
+    file.reset(new mapped_file(document.name));
+  }
+  char const* const data = (file.get() == 0 ? document.data : file->data());
+  std::size_t const size = (file.get() == 0 ? document.size : file->size());
+  stats::add(stats::flat_bytes, size);
+  document_bytes += size;
+  if (search_meta and not grep_meta_fields(data, size, document.name, emptystr, filename))
+    return;
+  if (not search_content)
+    return;
+  extractor_type const how = (extractor == dom_extractor ? reader_extractor : extractor);
+  grep_stream(data, size, document.name, emptystr, filename, how);
+}
+
+/** Read the media type of a document.
+ * @param zip the document
+ * @return the contents of the mimetype stream, or an empty string if there is none
+ */
+std::string mimetype(Zip::Archive& zip)
+{
+  if (zip.locate("mimetype") < 0)
+    return emptystr;
+  Zip::File file(zip, "mimetype");
+  return inflate(file);
+}
+
+/** List the streams of a package that hold text, from its manifest.
+ * A package without a readable manifest is searched as though the
+ * manifest listed just content.xml and styles.xml.
+ * Listed streams that are missing from the package are left out,
+ * except content.xml, whose absence is reported when it is opened.
+ * @param zip the package
+ * @param document the path to the document file, for error messages
+ * @return the paths of the streams, with content.xml first
+ * @throw Zip::Exception if content.xml is encrypted
+ */
+std::vector<std::string> package_streams(Zip::Archive& zip, std::string const& document)
+{
+  std::vector<odf::manifest_entry> manifest;
+  if (zip.locate("META-INF/manifest.xml") >= 0)
+  {
+    Zip::File file(zip, "META-INF/manifest.xml");
+    std::string const text(inflate(file));
+    try
+    {
+      manifest = odf::read_manifest(text.data(), text.size());
+    }
+    catch (std::runtime_error&)
+    {
+      manifest.clear();
+    }
+  }
+  if (manifest.empty())
+  {
+    manifest.resize(2);
+    manifest[0].path = "content.xml";
+    manifest[1].path = "styles.xml";
+    manifest[0].encrypted = manifest[1].encrypted = false;
+  }
+
+  for (std::vector<odf::manifest_entry>::iterator e = manifest.begin(); e != manifest.end(); ++e)
+    if (e->path == "content.xml" and e->encrypted)
+      throw Zip::Exception(document, "content.xml is encrypted");
+
+  std::vector<std::string> result;
+  std::vector<std::string> const streams(odf::text_streams(manifest));
+  for (std::vector<std::string>::const_iterator s = streams.begin(); s != streams.end(); ++s)
+    if (*s == "content.xml" or zip.locate(s->c_str()) >= 0)
+      result.push_back(*s);
+  return result;
+}
+
+/** One stream of a package, for a worker thread to search.
+ */
+struct stream_task
+{
+  std::string path;                 ///< the stream's path in the package
+  std::string filename;             ///< the name to report, decorated with @c path
+  std::vector<saved_match> matches; ///< the matches, in document order
+  std::string error;                ///< why the stream could not be searched, or empty
+  bool zip_error;                   ///< true if @c error came from libzip
+};
+
+/** The streams of a package, shared by the threads that search them.
+ * Each thread opens the package for itself, because one libzip archive
+ * cannot be read by two threads at once, and takes the next stream
+ * until none are left.
+ */
+class stream_queue
+{
+public:
+  /// @param document the package
+  /// @param tasks the streams to search
+  /// @param how the extractor to use
+  stream_queue(document_source const& document, std::vector<stream_task>& tasks, extractor_type how)
+  : document_(document), tasks_(tasks), how_(how), next_(0), helped_(), helped_bytes_(0)
+  {}
+
+  /// Search streams until none are left. This is the body of each thread.
+  void work()
+  {
+    std::auto_ptr<arena> stream_arena(use_arena ? new arena : 0);
+    std::auto_ptr<Zip::Archive> zip;
+    current_document = &document_.name;
+    while (stream_task* task = take())
+    {
+      std::auto_ptr<arena::scope> scope(use_arena ? new arena::scope(*stream_arena) : 0);
+      try
+      {
+        if (zip.get() == 0)
+          zip.reset(document_.open());
+        Zip::File file(*zip, task->path.c_str());
+        std::string const text(inflate(file));
+        if (multiline)
+        {
+          document_buffer buffer;
+          run_extractor(how_, text.data(), text.size(), file.pathname(), buffer);
+          buffer.search(task->filename, task->path, task->matches);
+        }
+        else
+        {
+          context_saver saver(task->filename, task->matches);
+          match_sink sink(task->path, saver);
+          run_extractor(how_, text.data(), text.size(), file.pathname(), sink);
+        }
+      }
+      catch (Zip::Exception& ex)
+      {
+        task->error = ex.what();
+        task->zip_error = true;
+      }
+      catch (std::exception& ex)
+      {
+        task->error = ex.what();
+        task->zip_error = false;
+      }
+    }
+    arena::fold();
+  }
+
+  /// Search streams in a helper thread, and keep the thread's statistics
+  /// and bytes for the thread that searches the document.
+  void help()
+  {
+    work();
+    stats::totals_type const totals = stats::take();
+    boost::mutex::scoped_lock lock(mutex_);
+    helped_ += totals;
+    helped_bytes_ += document_bytes;
+  }
+
+  /// @return the statistics of the helper threads
+  stats::totals_type const& helped() const { return helped_; }
+  /// @return the bytes that the helper threads inflated
+  unsigned long long helped_bytes() const { return helped_bytes_; }
+
+private:
+  stream_queue(stream_queue const&);   ///< not implemented
+  void operator=(stream_queue const&); ///< not implemented
+
+  /// @return the next stream to search, or a null pointer if none are left
+  stream_task* take()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return next_ == tasks_.size() ? 0 : &tasks_[next_++];
+  }
+
+  document_source const& document_; ///< the package
+  std::vector<stream_task>& tasks_; ///< the streams to search
+  extractor_type const how_;        ///< the extractor to use
+  std::size_t next_;                ///< index of the next stream to take
+  stats::totals_type helped_;       ///< the statistics of the helper threads
+  unsigned long long helped_bytes_; ///< the bytes that the helper threads inflated
+  boost::mutex mutex_;              ///< protects @c next_, @c helped_, and @c helped_bytes_
+};
+
+/** Search several streams of a package concurrently.
+ * Worker threads save their matches, and the matches are reported in
+ * the order of @p paths after every stream has been searched, so the
+ * output does not depend on which thread finishes first.
+ * @param document the package
+ * @param paths the streams to search, in the order to report them
+ * @param filename the document filename to print
+ * @param how the extractor to use
+ * @param threads the number of threads, including the calling thread
+ */
+void grep_streams(document_source const& document, std::vector<std::string> const& paths,
+                  std::string const& filename, extractor_type how, unsigned threads)
+{
+  std::vector<stream_task> tasks(paths.size());
+  for (std::vector<stream_task>::size_type i = 0; i != tasks.size(); ++i)
+  {
+    tasks[i].path = paths[i];
+    tasks[i].filename = stream_label(filename, paths[i]);
+    tasks[i].zip_error = false;
+  }
+
+  stream_queue queue(document, tasks, how);
+  boost::thread_group workers;
+  for (unsigned n = 1; n < threads; ++n)
+    workers.add_thread(new boost::thread(&stream_queue::help, &queue));
+  queue.work();
+  workers.join_all();
+  stats::merge(queue.helped());
+  document_bytes += queue.helped_bytes();
+
+  for (std::vector<stream_task>::const_iterator task = tasks.begin(); task != tasks.end(); ++task)
+  {
+    if (not report_saved(task->matches))
+      return;
+    if (task->zip_error)
+      throw Zip::Exception(task->error);
+    else if (not task->error.empty())
+      throw std::runtime_error(task->error);
+  }
+}
+
+/** Grep a packaged document.
+ * Open the document as a ZIP file, and then open each stream that
+ * holds text: content.xml, the page headers and footers in styles.xml,
+ * and the streams of embedded objects (and optionally the meta.xml
+ * stream). The manifest lists the streams. Encrypted streams cannot be
+ * read, so they are skipped without being inflated. When a large package
+ * has several streams, they are searched concurrently.
+ * @param document the package
+ * @param filename the document filename to print
+ */
+void grep_package(document_source const& document, std::string const& filename)
+{
+  std::auto_ptr<Zip::Archive> const package(document.open());
+  Zip::Archive& zip = *package;
+
+  if (search_meta and not grep_meta(zip, filename))
+    return;
+  if (not search_content)
+    return;
+
+  // A spreadsheet or spreadsheet template can have millions of rows, so it is never parsed into a tree.
+  static std::vector<std::string> const spreadsheet(1, "spreadsheet");
+  extractor_type how = extractor;
+  if (how == dom_extractor and odf::is_type(mimetype(zip), spreadsheet))
+    how = reader_extractor;
+
+  std::vector<std::string> const streams(package_streams(zip, document.name));
+  // --extractor=compare reports differences as it goes, so it stays on one thread.
+  // With --jobs, the documents already keep the threads busy. A small
+  // package is not worth the threads and the extra zip_open for each, and
+  // searching it in order lets -l, -q, and -m stop at the first stream that is enough.
+  unsigned threads = (how == compare_extractors or jobs > 1 ? 1 :
+                      std::min<std::size_t>(streams.size(), boost::thread::hardware_concurrency()));
+  if (threads > 1)
+  {
+    zip_uint64_t size = 0;
+    for (std::vector<std::string>::const_iterator s = streams.begin(); s != streams.end(); ++s)
+      size += zip.compressed_size(s->c_str());
+    if (size <= concurrent_streams_size)
+      threads = 1;
+  }
+  if (threads > 1)
+    grep_streams(document, streams, filename, how, threads);
+  else
+    for (std::vector<std::string>::const_iterator s = streams.begin(); s != streams.end(); ++s)
+    {
+      Zip::File file(zip, s->c_str());
+      if (not grep_content(file, stream_label(filename, *s), how))
+        break;
+    }
+}
+
+/** Decide which name to print with the matches in a document.
+ * @param name the name of the document
+ * @param in_bundle true for a member of a bundle, which is one of many documents
+ * @return @p name, or an empty string if file names are not printed
+ */
+std::string const& filename_for(std::string const& name, bool in_bundle)
+{
+  if (print_filename == always or (print_filename == multiple and (in_bundle or documents.size() > 1)))
+    return name;
+  return emptystr;
+}
+
+/** Test a document against --type, --min-size, and --max-size.
+ * @param size the number of bytes in the document
+ * @param prefix the start of the document
+ * @param length the number of bytes in @p prefix, at most #prefix_size
+ * @return true to search the document
+ */
+bool passes_filters(off_t size, char const* prefix, std::size_t length)
+{
+  if (size < min_size or (max_size >= 0 and size > max_size))
+    return false;
+  return types.empty() or odf::is_type(odf::mimetype_of(prefix, length), types);
+}
+
+/** Test the time a document was saved against --newer-than.
+ * @param saved the time the document was saved
+ * @return true to search the document
+ */
+bool is_newer(std::time_t saved)
+{
+  return newer_than < 0 or saved > newer_than;
+}
+
+/** Test a document against --newer-than, using the time that content.xml
+ * was saved, from the ZIP central directory. Nothing is inflated.
+ * @param document the package
+ * @return true to search the document; a package that cannot be opened
+ * is searched, so the error is reported
+ */
+bool is_newer_package(document_source const& document)
+{
+  try
+  {
+    std::auto_ptr<Zip::Archive> const zip(document.open());
+    return is_newer(zip->mtime("content.xml"));
+  }
+  catch (Zip::Exception&)
+  {
+    return true;
+  }
+}
+
+/** Test whether the start of a file is the start of an ODF document.
+ * @param prefix the start of the file
+ * @param length the number of bytes in @p prefix
+ * @return true for a package or flat document whose media type is ODF
+ */
+bool is_document(char const* prefix, std::size_t length)
+{
+  return odf::is_odf(odf::mimetype_of(prefix, length));
+}
+
+/** Test whether a ZIP file is a bundle of documents instead of an ODF package.
+ * A package has content.xml or a mimetype entry, and a bundle has neither.
+ * @param document the ZIP file
+ * @return true for a bundle; a file that cannot be opened is not a bundle,
+ * so the error is reported when it is searched as a package
+ */
+bool is_zip_bundle(document_source const& document)
+{
+  try
+  {
+    std::auto_ptr<Zip::Archive> const zip(document.open());
+    return zip->locate("content.xml") < 0 and zip->locate("mimetype") < 0;
+  }
+  catch (Zip::Exception&)
+  {
+    return false;
+  }
+}
+
+/// A document that --slow-log recorded, for the summary at exit.
+struct slow_document
+{
+  std::string name;               ///< the document
+  unsigned long long nanoseconds; ///< the time it took to search the document
+  stats::totals_type totals;      ///< its statistics
+};
 
-std::vector<std::string> documents; ///< list of documents to search
+std::vector<slow_document> slow_documents; ///< the documents that --slow-log recorded
+boost::mutex slow_mutex;                   ///< protects @c slow_documents and the writes to the --slow-log
 
-boost::wregex pattern; ///< The regexp
-std::string pattern_text; ///< The regexp string from the command line
-std::auto_ptr<action> act; ///< The action to take when a match is found
+/** Append a time to a buffer, in seconds.
+ * @param out the buffer
+ * @param nanoseconds the time
+ */
+void write_seconds(output_buffer& out, unsigned long long nanoseconds)
+{
+  out.write_number(nanoseconds / 1000000000);
+  out.put('.');
+  char digits[9];
+  unsigned long fraction = nanoseconds % 1000000000;
+  for (int i = 8; i >= 0; --i, fraction /= 10)
+    digits[i] = static_cast<char>('0' + fraction % 10);
+  out.write(digits, sizeof(digits));
+}
 
-std::string const emptystr; ///< global empty string
+/** Record a document in the --slow-log if it took longer than
+ * --slow-threshold, or if any one stage did. A stage can take longer
+ * than the document when helper threads search its streams.
+ * The document's statistics are the calling thread's, which have not
+ * been folded since the document started.
+ * @param name the document
+ * @param nanoseconds the time it took to search the document
+ */
+void log_if_slow(std::string const& name, unsigned long long nanoseconds)
+{
+  unsigned long long const threshold = slow_threshold * 1000000ULL;
+  stats::totals_type const& totals = stats::local();
+  bool slow = nanoseconds > threshold;
+  for (int s = 0; s != stats::stage_count and not slow; ++s)
+    slow = totals.nanoseconds[s] > threshold;
+  if (not slow)
+    return;
 
-/** Read the pattern from a file.
-  * @param filename the name of the file to read
-  * @return the pattern, as read from @p filename
-  */
-std::string read_pattern(char const* filename)
+  output_buffer line;
+  line.write("{\"document\":", 12);
+  line.write_json(name);
+  line.write(",\"seconds\":", 11);
+  write_seconds(line, nanoseconds);
+  line.write(",\"compressed_bytes\":", 20);
+  line.write_number(totals.counts[stats::compressed_bytes]);
+  line.write(",\"inflated_bytes\":", 18);
+  line.write_number(totals.counts[stats::inflated_bytes]);
+  line.write(",\"paragraphs\":", 14);
+  line.write_number(totals.counts[stats::paragraphs]);
+  line.write(",\"longest_paragraph\":", 21);
+  line.write_number(totals.longest_paragraph);
+  line.write(",\"matches\":", 11);
+  line.write_number(totals.counts[stats::matches]);
+  line.write(",\"stages\":{", 11);
+  for (int s = 0; s != stats::stage_count; ++s)
+  {
+    if (s != 0)
+      line.put(',');
+    line.put('"');
+    line.write(stats::name(static_cast<stats::stage>(s)));
+    line.write("\":", 2);
+    write_seconds(line, totals.nanoseconds[s]);
+  }
+  line.write("}}\n", 3);
+
+  slow_document document;
+  document.name = name;
+  document.nanoseconds = nanoseconds;
+  document.totals = totals;
+  boost::mutex::scoped_lock lock(slow_mutex);
+  if (not line.flush(slow_log_fd))
+  {
+    std::cerr << slow_log << ": " << std::strerror(errno) << '\n';
+    status = io_error;
+  }
+  slow_documents.push_back(document);
+}
+
+/** Grep one document, which is a package or a flat document.
+ * @param document the document
+ * @param filename the document filename to print
+ */
+void search_document(document_source const& document, std::string const& filename)
 {
-  std::ifstream in(filename);
-  if (not in)
+  stats::document_span span(document.name);
+  unsigned long long const begin = (slow_log_fd < 0 ? 0 : stats::now());
+  act->initialize();
+  current_document = &document.name;
+  document_bytes = 0;
+  printed_group = false;
+  std::auto_ptr<arena::scope> scope(use_arena ? new arena::scope(*document_arena) : 0);
+  try
   {
-    perror(filename);
-    std::exit(cmdline_error);
+    match_count = 0;
+    if (document.flat)
+      grep_flat(document, filename);
+    else
+      grep_package(document, filename);
   }
-  std::ostringstream out;
-  out << in.rdbuf();
-  return out.str();
+  catch (std::exception& ex)
+  {
+    // A package that cannot be opened or a stream that cannot be parsed
+    // spoils only this document, with or without --jobs.
+    std::cerr << ex.what() << '\n';
+    status = io_error;
+  }
+  {
+    stats::timer timer(stats::output_stage);
+    act->finish_file(document.name, match_count);
+  }
+  stats::add(stats::documents);
+  progress::add(document_bytes, match_count);
+  if (slow_log_fd >= 0)
+    log_if_slow(document.name, stats::now() - begin);
+  stats::fold();
 }
 
-/** Test one paragraph for a match.
- * If the paragraph matches, perform the action, set the exit status to success,
- * and increment the match count. The user can request that searching stop
- * at a predetermined match count.
- * @param text the text to search
- * @param filename the name of the file that contains the @p text
- * @return true to continue searching for matches or false to stop searching this file
+/** Grep a document that was found in a bundle.
+ * The filters apply to the member, using its size and the time that the
+ * bundle records for it.
+ * @param label the name of the member, such as bundle.tar!path/doc.odt
+ * @param contents the member
+ * @param mtime the modification time of the member
  */
-bool match(std::string const& text, std::string const& filename)
+void grep_member(std::string const& label, std::string const& contents, std::time_t mtime)
 {
-  bool result = true;
-  if (boost::regex_search(utf8_to_utf32(text), pattern, boost::match_any) != invert)
+  std::size_t const length = std::min(contents.size(), prefix_size);
+  if (have_filters and not (passes_filters(contents.size(), contents.data(), length) and is_newer(mtime)))
+    return;
+  search_document(document_source(label, contents, odf::is_flat(contents.data(), length)),
+                  filename_for(label, true));
+}
+
+/// A read-only stream buffer over a block of memory, so that a bundle
+/// in memory can be read like a file without being copied.
+class memory_streambuf : public std::streambuf
+{
+public:
+  /// Construct the stream buffer.
+  /// @param data the memory, which must outlive the stream buffer
+  /// @param size the number of bytes at @p data
+  memory_streambuf(char const* data, std::size_t size)
+  {
+    char* const begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+  }
+};
+
+/** Grep the documents in a tar bundle.
+ * The bundle is read once, from start to finish, without seeking. Each
+ * member that is an ODF document is read into memory and searched;
+ * other members are skipped after their first few kilobytes.
+ * @param bundle the tar file
+ */
+void grep_tar(document_source const& bundle)
+{
+  std::ifstream file;
+  memory_streambuf memory(bundle.data, bundle.size);
+  std::istream buffer(&memory);
+  if (bundle.data == 0)
+    file.open(bundle.name.c_str(), std::ios_base::in | std::ios_base::binary);
+  tar_reader tar(bundle.data == 0 ? static_cast<std::istream&>(file) : buffer, bundle.name);
+  std::string contents;
+  try
   {
-    if (max_count == 0 or match_count != max_count)
+    while (tar.next())
     {
-      result = act->perform(text, filename);
-      status = success;
-      ++match_count;
+      if (tar.size() == 0)
+        continue;
+      contents.resize(std::min(tar.size(), prefix_size));
+      contents.resize(tar.read(&contents[0], contents.size()));
+      if (not is_document(contents.data(), contents.size()))
+        continue;
+      std::size_t const start = contents.size();
+      contents.resize(tar.size());
+      tar.read(&contents[start], contents.size() - start);
+      grep_member(bundle.name + '!' + tar.path(), contents, tar.mtime());
     }
   }
-  return result;
+  catch (tar_reader::error& ex)
+  {
+    std::cerr << ex.what() << '\n';
+    status = io_error;
+  }
 }
-bool match(xmlChar const* text, int len, std::string const& filename)
+
+/** Grep the documents in a ZIP bundle, that is, a ZIP file of ODF documents.
+ * Each member that is an ODF document is inflated into memory and
+ * opened from there as a package; other members are skipped after their
+ * first few kilobytes. A member that cannot be read is reported as
+ * bundle!path, and the search goes on with the next member.
+ * @param bundle the ZIP file
+ */
+void grep_zip_bundle(document_source const& bundle)
 {
-  bool result = true;
-  if (boost::regex_search(utf8_to_utf32(text, len), pattern, boost::match_any) != invert)
+  try
   {
-    if (max_count == 0 or match_count != max_count)
+    std::auto_ptr<Zip::Archive> const archive(bundle.open());
+    Zip::Archive& zip = *archive;
+    std::string contents;
+    for (int i = 0; i != zip.get_num_files(); ++i)
     {
-      result = act->perform(xml::string(text, len), filename);
-      status = success;
-      ++match_count;
+      std::string const path = zip.get_file(i);
+      if (path.empty() or path[path.size() - 1] == '/')
+        continue;
+      std::string const member = bundle.name + '!' + path;
+      // A member that is encrypted or corrupt does not stop the rest of the bundle.
+      try
+      {
+        Zip::File file(zip, path.c_str());
+        unsigned char prefix[prefix_size];
+        std::size_t length = 0;
+        while (int n = file.read(prefix + length, prefix_size - length))
+          if ((length += n) == prefix_size)
+            break;
+        if (not is_document(reinterpret_cast<char const*>(prefix), length))
+          continue;
+        contents.assign(reinterpret_cast<char const*>(prefix), length);
+        contents += file.read();
+        grep_member(member, contents, zip.mtime(path.c_str()));
+      }
+      catch (Zip::Exception& ex)
+      {
+        // libzip names the member bundle[path]; report it as bundle!path, as its matches are.
+        std::string message(ex.what());
+        std::string const inner = bundle.name + '[' + path + ']';
+        if (message.compare(0, inner.size(), inner) == 0)
+          message.replace(0, inner.size(), member);
+        std::cerr << message << '\n';
+        status = io_error;
+      }
     }
   }
-  return result;
+  catch (Zip::Exception& ex)
+  {
+    std::cerr << ex.what() << '\n';
+    status = io_error;
+  }
 }
 
-/** Grep a meta stream in a document.
- * Extract the text, one node at a time,
- * and match the pattern against the node's contents.
- * When a match is found, include the node name in the identifying file name.
- * @param file the stream in the document
- * @return true to keep searching this document
+/** Grep a file named on the command line, which is a ZIP package or a
+ * flat ODF document, or a tar or ZIP bundle of such documents. The
+ * filters are applied to each document, not to a bundle.
+ * @param file the file; its @c flat member is ignored
+ * @param prefix the start of the file
+ * @param length the number of bytes in @p prefix
+ * @param info the size and modification time of the file, or null to
+ * search the file without applying the filters
  */
-bool grep_meta(Zip::File& file, std::string filename)
+void grep_file(document_source file, char const* prefix, std::size_t length, struct stat const* info)
 {
-  std::string text(file.read());
-  xml::doc doc;
-  doc.parse(text);
+  file.flat = odf::is_flat(prefix, length);
+  if (tar_reader::is_tar(prefix, length))
+    grep_tar(file);
+  else if (not file.flat and not is_document(prefix, length) and is_zip_bundle(file))
+    grep_zip_bundle(file);
+  else if (not have_filters or info == 0 or
+           (passes_filters(info->st_size, prefix, length) and
+            (file.flat ? is_newer(info->st_mtime) : newer_than < 0 or is_newer_package(file))))
+    search_document(file, filename_for(file.name, false));
+}
 
-  // The root element is <document:meta>, and its child is <meta>.
-  for (xmlNode* node = doc.get_root_element()->children->children; node != 0; node = node->next)
+/** Grep a document that is read from the standard input.
+ * The whole input is read into memory and opened from there, so a
+ * package never touches the file system. A pipe has no modification time
+ * of its own, so --newer-than checks only packages, by the time of
+ * content.xml, unless the standard input is a regular file.
+ */
+void grep_stdin()
+{
+  std::string contents;
+  char buffer[65536];
+  while (std::size_t n = std::fread(buffer, 1, sizeof(buffer), stdin))
+    contents.append(buffer, n);
+  if (std::ferror(stdin))
   {
-    std::string text = xml::get_content(node);
-    std::string file = (print_filename ? filename + "<" + xml::string(node->name) + ">" : emptystr);
-    if (not match(text, file))
-      return false;
+    std::cerr << stdin_label << ": " << std::strerror(errno) << '\n';
+    status = io_error;
+    return;
   }
-  return true;
+
+  struct stat info;
+  bool const have_info = ::fstat(0, &info) == 0;
+  info.st_size = contents.size();
+  // The modification time of a pipe is about now, which says nothing about the document.
+  if (have_info and not S_ISREG(info.st_mode))
+    info.st_mtime = 0;
+  grep_file(document_source(stdin_label, contents, false),
+            contents.data(), std::min(contents.size(), prefix_size), have_info ? &info : 0);
 }
 
-/** Grep a node in a document body.
- * @param parent the parent &lt;text&gt; node
- * @return true to continue searching for matches or false to stop searching this file
+/** Grep a file named on the command line.
+ * @param document the path to the file, or "-" for the standard input
+ */
+void grep_document(std::string const& document)
+{
+  if (document == "-")
+  {
+    grep_stdin();
+    return;
+  }
+
+  char prefix[prefix_size];
+  std::ifstream in(document.c_str(), std::ios_base::in | std::ios_base::binary);
+  in.read(prefix, sizeof(prefix));
+  std::size_t const length = in.gcount();
+  in.close();
+
+  struct stat info;
+  // A file that cannot be read is searched, so the error is reported.
+  bool const have_info = ::stat(document.c_str(), &info) == 0;
+  grep_file(document_source(document, false), prefix, length, have_info ? &info : 0);
+}
+
+/** The documents named on the command line, for --jobs.
+ * Each job thread takes the next document, searches it with its output
+ * redirected into the document's own buffer, and hands the buffer over
+ * when it is done. The main thread writes the buffers in command-line
+ * order, so the output is the same as if the documents were searched
+ * one by one. The mutex guards only the hand-over, never a search or a
+ * write, and jobs do not run too far ahead of the writer, so the
+ * buffers that wait to be written stay few.
  */
-bool grep_node(xmlNode* parent, std::string const& filename)
+class document_queue
 {
-  for (xmlNode* node = parent->children ; node != 0; node = node->next)
+public:
+  /// @param documents the documents to search
+  /// @param ahead how many documents can be finished but not yet written
+  document_queue(std::vector<std::string> const& documents, std::size_t ahead)
+  : documents_(documents), jobs_(documents.size()), ahead_(ahead), next_(0), written_(0)
+  {}
+
+  /// Search documents until none are left. This is the body of each job thread.
+  void work()
   {
-    if (std::strcmp(xml::charptr(node->name), "p") == 0 or
-        std::strcmp(xml::charptr(node->name), "h") == 0)
+    arena job_arena;
+    document_arena = &job_arena;
+    std::size_t index;
+    while (take(index))
     {
-      if (not match(xml::get_content(node), filename))
-        return false;
+      job& j = jobs_[index];
+      j.output = new output_buffer;
+      {
+        output_buffer::scope redirect(*j.output);
+        status = nomatch;
+        grep_document(documents_[index]);
+      }
+      progress::done();
+      boost::mutex::scoped_lock lock(mutex_);
+      j.status = status;
+      j.done = true;
+      changed_.notify_all();
     }
-    else if (search_deleted or std::strcmp(xml::charptr(node->name), "deletion") != 0)
+    arena::fold();
+    stats::fold();
+  }
+
+  /// Write the output of each document in order, as each is done.
+  /// This is the body of the main thread.
+  /// @return false if the standard output could not be written, with errno set
+  bool write()
+  {
+    bool result = true;
+    for (std::size_t i = 0; i != jobs_.size(); ++i)
     {
-      // Recursively search the contents of a section, table, list, index, etc.
-      // The only elements not to check recursively are for deleted text.
-      if (not grep_node(node, filename))
-        return false;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (not jobs_[i].done)
+          changed_.wait(lock);
+      }
+      std::auto_ptr<output_buffer> output(jobs_[i].output);
+      if (not output->flush(STDOUT_FILENO))
+        result = false;
+      // The job's last word on the exit status wins, as it would one by one.
+      if (jobs_[i].status != nomatch)
+        status = jobs_[i].status;
+      boost::mutex::scoped_lock lock(mutex_);
+      ++written_;
+      changed_.notify_all();
     }
+    return result;
   }
-  return true;
-}
 
-/** Grep a document body.
- * Find the \<text\> element as a child of \<body\>.
- * @param parent the \<body\> node.
- * @param filename the document file name
+private:
+  /// One document and its output.
+  struct job
+  {
+    job() : output(0), status(nomatch), done(false) {}
+    output_buffer* output; ///< what the job printed, which the writer deletes
+    exit_status status;    ///< the exit status that the job set, or nomatch
+    bool done;             ///< true after the job is finished
+  };
+
+  document_queue(document_queue const&); ///< not implemented
+  void operator=(document_queue const&); ///< not implemented
+
+  /// Take the next document, waiting while too many are waiting to be written.
+  /// @param index receives the index of the document
+  /// @return false if none are left
+  bool take(std::size_t& index)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (next_ != jobs_.size() and next_ >= written_ + ahead_)
+      changed_.wait(lock);
+    if (next_ == jobs_.size())
+      return false;
+    index = next_++;
+    return true;
+  }
+
+  std::vector<std::string> const& documents_; ///< the documents to search
+  std::vector<job> jobs_;           ///< one job for each document
+  std::size_t const ahead_;         ///< how far the jobs can run ahead of the writer
+  std::size_t next_;                ///< index of the next document to take
+  std::size_t written_;             ///< number of documents whose output was written
+  boost::mutex mutex_;              ///< protects @c next_, @c written_, and each job's @c done and @c status
+  boost::condition_variable changed_; ///< signals that a job is done or its output was written
+};
+
+/** Grep every document named on the command line, --jobs at a time.
+ * @return false if the standard output could not be written, with errno set
  */
-void grep_body(xmlNode* parent, std::string const& filename)
+bool grep_documents()
 {
-  for (xmlNode* node = parent->children ; node != 0; node = node->next)
+  if (jobs == 1)
   {
-    if (std::strcmp(xml::charptr(node->name), "text") == 0)
+    for (std::vector<std::string>::const_iterator d = documents.begin(); d != documents.end(); ++d)
     {
-      grep_node(node, filename);
-      break;
+      grep_document(*d);
+      progress::done();
     }
+    return true;
   }
+
+  document_queue queue(documents, 4 * jobs);
+  boost::thread_group workers;
+  for (unsigned n = 0; n != jobs; ++n)
+    workers.add_thread(new boost::thread(&document_queue::work, &queue));
+  bool const result = queue.write();
+  workers.join_all();
+  return result;
 }
 
-/** Grep a content stream in a document.
- * Extract the text, one paragraph at a time,
- * and match the pattern against the paragraph.
- * All ODF documents have \<document-content\> as the root
- * element. Text documents can contain scripts and whatnot,
- * and the body of the document is contained in the \<body\>
- * element. It contains styles and whatnot, and the main text
- * is found in the \<text\> element.
- * @param file the stream in the document
- * @param filename the document filename
+/** Print the statistics that were gathered during the run, in the format
+ * that --stats asked for. The allocation counters are available only when
+ * the libxml2 memory hooks are installed, which --stats does even without
+ * --arena. With --stats-file, the report is written to a temporary file
+ * that is renamed over the file, so a collector that reads the file never
+ * sees half a report.
+ * @throw std::runtime_error if the file cannot be written
  */
-void grep_content(Zip::File& file, std::string filename)
+void print_stats()
 {
-  std::string text(file.read());
-  xml::doc doc;
-  doc.parse(text);
-  for (xmlNode* node = doc.get_root_element()->children ; node != 0; node = node->next)
-    if (std::strcmp(xml::charptr(node->name), "body") == 0)
-    {
-      grep_body(node, filename);
-      break;
-    }
+  if (stats_file == 0)
+  {
+    stats::report(std::cerr, stats_format);
+    return;
+  }
+  std::string const temporary = std::string(stats_file) + ".tmp";
+  std::ofstream out(temporary.c_str());
+  stats::report(out, stats_format);
+  out.close();
+  if (not out or std::rename(temporary.c_str(), stats_file) != 0)
+    throw std::runtime_error(std::string(stats_file) + ": " + std::strerror(errno));
 }
 
-/** Grep a document.
- * Open the document as a ZIP file, and then open the content.xml stream
- * (and optionally the meta.xml stream). Grep the stream.
- * @param document the path to the document file
+/** Write the spans that were recorded for --trace.
+ * @throw std::runtime_error if the file cannot be written
  */
-void grep_document(std::string const& document)
+void write_trace()
 {
-  act->initialize();
-  try
-  {
-    Zip::Archive zip(document);
-    match_count = 0;
+  int const fd = open(trace_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    throw std::runtime_error(std::string(trace_file) + ": " + std::strerror(errno));
+  output_buffer out(fd);
+  stats::write_trace(out);
+  bool const written = out.flush();
+  if (close(fd) != 0 or not written)
+    throw std::runtime_error(std::string(trace_file) + ": " + std::strerror(errno));
+}
 
+/// @return true if document @p a took longer than @p b
+bool slower(slow_document const& a, slow_document const& b)
+{
+  return a.nanoseconds > b.nanoseconds;
+}
+
+/** Print the slowest of the documents that --slow-log recorded to the
+ * standard error, with the stage that took the longest in each.
+ * The number of documents comes from --top, and is 10 by default.
+ */
+void print_slow_documents()
+{
+  std::size_t const n = std::min<std::size_t>(top == 0 ? 10 : top, slow_documents.size());
+  if (n == 0)
+    return;
+  std::partial_sort(slow_documents.begin(), slow_documents.begin() + n, slow_documents.end(), slower);
+  std::cerr << "slowest documents:\n";
+  for (std::vector<slow_document>::const_iterator d = slow_documents.begin(); d != slow_documents.begin() + n; ++d)
+  {
+    int longest = 0;
+    for (int s = 1; s != stats::stage_count; ++s)
+      if (d->totals.nanoseconds[s] > d->totals.nanoseconds[longest])
+        longest = s;
+    char seconds[32];
+    std::sprintf(seconds, "%12.6f s  ", d->nanoseconds / 1e9);
+    std::cerr << seconds << d->name << " (" << stats::name(static_cast<stats::stage>(longest)) << ' ';
+    std::sprintf(seconds, "%.6f s)", d->totals.nanoseconds[longest] / 1e9);
+    std::cerr << seconds << '\n';
+  }
+}
 
-    if (search_meta)
+/** Give --aggregate the options that are known after the command line is parsed.
+ * Each line of the pattern is compiled by itself, to count its matches.
+ * @param a the action
+ */
+void prepare_aggregate(aggregate& a)
+{
+  std::vector<std::string> names;
+  std::vector<boost::wregex> patterns;
+  std::string::size_type start = 0;
+  do
+  {
+    std::string::size_type const end = std::min(pattern_text.find('\n', start), pattern_text.size());
+    if (end != start)
     {
-      Zip::File meta(zip, "meta.xml");
-      grep_content(meta, print_filename ? document : emptystr);
+      names.push_back(pattern_text.substr(start, end - start));
+      patterns.push_back(boost::wregex(utf8_to_utf32(names.back()), flavor | flags));
     }
+    start = end + 1;
+  } while (start < pattern_text.size());
+  a.prepare((flags & boost::regex_constants::icase) != 0, top, names, patterns);
+}
 
-    Zip::File content(zip, "content.xml");
-    grep_content(content, print_filename ? document : emptystr);
+/** Parse a file size for --min-size or --max-size.
+ * The number can have a suffix of k, M, or G for binary multiples.
+ * @param arg the size from the command line
+ * @return the number of bytes
+ */
+off_t parse_size(char const* arg)
+{
+  char* end;
+  double size = std::strtod(arg, &end);
+  switch (*end)
+  {
+    case 'G': case 'g': size *= 1024;
+      // fall through
+    case 'M': case 'm': size *= 1024;
+      // fall through
+    case 'K': case 'k': size *= 1024;
+      ++end;
   }
-  catch (Zip::Exception& ex)
+  // The comparisons are false for NaN, and the bound keeps infinity and
+  // other sizes that off_t cannot hold from reaching the cast.
+  if (end == arg or *end != '\0' or
+      not (size >= 0 and size < static_cast<double>(std::numeric_limits<off_t>::max())))
   {
-    std::cerr << ex.what() << '\n';
-    status = io_error;
+    std::cerr << "Not a size: " << arg << '\n';
+    std::exit(cmdline_error);
+  }
+  return static_cast<off_t>(size);
+}
+
+/** Parse a date and time for --newer-than.
+ * The format is YYYY-MM-DD, optionally followed by HH:MM or HH:MM:SS,
+ * in local time.
+ * @param arg the date from the command line
+ * @return the time
+ */
+std::time_t parse_date(char const* arg)
+{
+  std::tm tm = std::tm();
+  char separator = ' ';
+  int end = 0;
+  int const fields = std::sscanf(arg, "%d-%d-%d%n%c%d:%d%n:%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &end,
+                                 &separator, &tm.tm_hour, &tm.tm_min, &end, &tm.tm_sec, &end);
+  if ((fields != 3 and fields != 6 and fields != 7) or arg[end] != '\0' or (separator != ' ' and separator != 'T'))
+  {
+    std::cerr << "Not a date: " << arg << '\n';
+    std::exit(cmdline_error);
   }
-  catch(...)
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  return std::mktime(&tm);
+}
+
+/** Parse the number of paragraphs of context for -A, -B, or -C.
+ * @param arg the number from the command line
+ * @return the number of paragraphs
+ */
+std::size_t parse_context(char const* arg)
+{
+  char* end;
+  long const count = std::strtol(arg, &end, 10);
+  if (end == arg or *end != '\0' or count < 0)
   {
-    throw;
+    std::cerr << "Not a number of paragraphs: " << arg << '\n';
+    std::exit(cmdline_error);
   }
-  act->finish_file(document, match_count);
+  return count;
 }
 
 /** Command line argument parser. The ARGP package calls back
@@ -279,6 +2385,15 @@ extern "C" error_t parse_func(int key, char *arg, struct argp_state *state)
 
   switch (key)
   {
+    case 'A':
+      after_context = parse_context(arg);
+      break;
+    case 'B':
+      before_context = parse_context(arg);
+      break;
+    case 'C':
+      before_context = after_context = parse_context(arg);
+      break;
     case 'c':
       act.reset(new count);
       break;
@@ -311,12 +2426,36 @@ extern "C" error_t parse_func(int key, char *arg, struct argp_state *state)
     case 'i':
       flags |= boost::regex_constants::icase;
       break;
+    case format_option:
+      if (std::strcmp(arg, "text") == 0)
+        act.reset(new echo_text);
+      else if (std::strcmp(arg, "json") == 0)
+        act.reset(new json_records);
+      else if (std::strcmp(arg, "binary") == 0)
+        act.reset(new binary_records);
+      else
+      {
+        std::cerr << "Unknown output format: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
+    case 'j':
+      jobs = std::strtoul(arg, &end, 10);
+      if (*end != '\0' or jobs == 0)
+      {
+        std::cerr << "Not a number of jobs: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
     case 'l':
       act.reset(new echo_file);
       break;
     case 'L':
       act.reset(new echo_nomatch);
       break;
+    case 'o':
+      act.reset(new only_matching);
+      break;
     case 'P':
       flavor = boost::regex_constants::perl;
       break;
@@ -330,6 +2469,7 @@ extern "C" error_t parse_func(int key, char *arg, struct argp_state *state)
         std::cerr << "Not a number: " << arg << '\n';
         std::exit(cmdline_error);
       }
+      break;
     case 'M':
       search_meta = true;
       break;
@@ -342,6 +2482,147 @@ extern "C" error_t parse_func(int key, char *arg, struct argp_state *state)
           "This is free software; see the source for copying conditions.  There is NO\n"
           "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n";
       std::exit(EXIT_SUCCESS);
+    case aggregate_option:
+      if (std::strcmp(arg, "match") == 0)
+        act.reset(new aggregate(aggregate::by_match));
+      else if (std::strcmp(arg, "document") == 0)
+        act.reset(new aggregate(aggregate::by_document));
+      else if (std::strcmp(arg, "pattern") == 0)
+        act.reset(new aggregate(aggregate::by_pattern));
+      else
+      {
+        std::cerr << "Unknown aggregate: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
+    case arena_option:
+      use_arena = true;
+      break;
+    case count_matches_option:
+      act.reset(new count_matches);
+      break;
+    case extractor_option:
+      if (std::strcmp(arg, "dom") == 0)
+        extractor = dom_extractor;
+      else if (std::strcmp(arg, "reader") == 0)
+        extractor = reader_extractor;
+      else if (std::strcmp(arg, "fast") == 0)
+        extractor = fast_extractor;
+      else if (std::strcmp(arg, "compare") == 0)
+        extractor = compare_extractors;
+      else
+      {
+        std::cerr << "Unknown extractor: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
+    case max_size_option:
+      max_size = parse_size(arg);
+      have_filters = true;
+      break;
+    case min_size_option:
+      min_size = parse_size(arg);
+      have_filters = true;
+      break;
+    case multiline_option:
+      multiline = true;
+      break;
+    case newer_than_option:
+      newer_than = parse_date(arg);
+      have_filters = true;
+      break;
+    case type_option:
+      if (not odf::parse_types(arg, types))
+      {
+        std::cerr << "Unknown document type: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      have_filters = true;
+      break;
+    case window_option:
+      window_size = parse_size(arg);
+      if (window_size < min_window_size)
+      {
+        std::cerr << "Window too small: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
+    case meta_field_option:
+      if (not odf::parse_meta_fields(arg, meta_fields))
+      {
+        std::cerr << "Unknown metadata field: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      // Only meta.xml is searched.
+      // fall through
+    case meta_only_option:
+      search_meta = true;
+      search_content = false;
+      break;
+    case progress_option:
+      progress_interval = 5;
+      if (arg != 0)
+      {
+        progress_interval = std::strtoul(arg, &end, 10);
+        if (*end != '\0' or progress_interval == 0)
+        {
+          std::cerr << "Not a number of seconds: " << arg << '\n';
+          std::exit(cmdline_error);
+        }
+      }
+      break;
+    case progress_file_option:
+      if (progress_interval == 0)
+        progress_interval = 5;
+      progress_file = arg;
+      break;
+    case scope_option:
+      if (not odf::parse_scope(arg, scope))
+      {
+        std::cerr << "Unknown scope: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
+    case stats_option:
+      show_stats = true;
+      if (arg == 0 or std::strcmp(arg, "text") == 0)
+        stats_format = stats::text_format;
+      else if (std::strcmp(arg, "json") == 0)
+        stats_format = stats::json_format;
+      else if (std::strcmp(arg, "prometheus") == 0)
+        stats_format = stats::prometheus_format;
+      else
+      {
+        std::cerr << "Unknown statistics format: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
+    case stats_file_option:
+      show_stats = true;
+      stats_file = arg;
+      break;
+    case slow_log_option:
+      slow_log = arg;
+      break;
+    case slow_threshold_option:
+      slow_threshold = std::strtoul(arg, &end, 10);
+      if (*end != '\0')
+      {
+        std::cerr << "Not a number of milliseconds: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
+    case trace_option:
+      trace_file = arg;
+      break;
+    case top_option:
+      top = std::strtoul(arg, &end, 10);
+      if (*end != '\0')
+      {
+        std::cerr << "Not a number: " << arg << '\n';
+        std::exit(cmdline_error);
+      }
+      break;
     case ARGP_KEY_ARG:
       if (have_pattern)
         documents.push_back(arg);
@@ -369,7 +2650,7 @@ extern "C" error_t parse_func(int key, char *arg, struct argp_state *state)
 } // end of namespace
 
 /** The main program. As you can see, the main program is pretty simple.
- * It sets up some XML stuff, then calls on ARGP to process the command line.
+ * It calls on ARGP to process the command line, then sets up some XML stuff.
  * @param argc number of command line arguments
  * @param argv the command line arguments
  * @returns 0 for success, EXIT_FAILURE if anything goes wrong.
@@ -377,23 +2658,50 @@ extern "C" error_t parse_func(int key, char *arg, struct argp_state *state)
 int main(int argc, char *argv[])
 {
   static argp_option options[] = {
+    { "after-context",       'A', "NUM",     0, "print NUM paragraphs after each matching paragraph" },
+    { "aggregate",           aggregate_option, "KIND", 0, "instead of printing matches, count them in all documents and print the most frequent: each distinct match, matches per document, or matches per pattern (KIND is match, document, or pattern)" },
+    { "arena",               arena_option, 0, 0, "allocate the parse tree and match buffers of each document from an arena that is released all at once" },
     { "basic-regexp",        'G', 0,         0, "PATTERN uses basic POSIX syntax" },
+    { "before-context",      'B', "NUM",     0, "print NUM paragraphs before each matching paragraph" },
+    { "context",             'C', "NUM",     0, "print NUM paragraphs before and after each matching paragraph" },
     { "count",               'c', 0,         0, "do not echo matching lines, but count the number of matches per file (or with -v, number of non-matching lines)" },
+    { "count-matches",       count_matches_option, 0, 0, "like --count, but count every match, not just the paragraphs that match" },
     { "deleted",             'd', 0,         0, "search in deleted text" },
     { "extended-regexp",     'E', 0,         0, "PATTERN uses exended POSIX regexp syntax" },
+    { "extractor",           extractor_option, "NAME", 0, "find paragraphs with NAME: dom (libxml2 tree, the default), reader (libxml2 pull parser), fast (ODF scanner), or compare (run all and report differences)" },
     { "file",                'f', "FILE",    0, "read regexps from FILE, one per line" },
     { "files-without-match", 'L', 0,         0, "print only names of files that contain no lines that match PATTERN"},
     { "files-with-match",    'l', 0,         0, "print only names of files that match PATTERN"},
     { "fixed-strings",       'F', 0,         0, "PATTERN is a list of newline-separated strings to match, not regular expressions" },
+    { "format",              format_option, "FORMAT", 0, "print each match as FORMAT: text, json (one JSON object per line, with positions), or binary (length-prefixed records)" },
     { "ignore-case",         'i', 0,         0, "ignore case distinctions"},
     { "invert-match",        'v', 0,         0, "invert match: print lines that do not match PATTERN" },
+    { "jobs",                'j', "N",       0, "search N documents at once; the output is in the same order as for one at a time" },
     { "max-count",           'm', "COUNT",   0, "stop reading after COUNT matches in one document" },
+    { "max-size",            max_size_option, "SIZE", 0, "skip documents larger than SIZE bytes; SIZE can end with k, M, or G" },
     { "meta",                'M', 0,         0, "search meta.xml in addition to content.xml"},
+    { "meta-field",          meta_field_option, "LIST", 0, "search only the metadata fields in LIST, such as dc:creator,meta:keyword, and not the document text" },
+    { "meta-only",           meta_only_option, 0, 0, "search meta.xml, but not content.xml or any other stream" },
+    { "min-size",            min_size_option, "SIZE", 0, "skip documents smaller than SIZE bytes; SIZE can end with k, M, or G" },
+    { "multiline",           multiline_option, 0, 0, "let the pattern match across paragraph breaks, which it sees as newlines" },
+    { "newer-than",          newer_than_option, "DATE", 0, "skip documents saved at or before DATE, given as YYYY-MM-DD [HH:MM[:SS]]" },
     { "no-filename",         'h', 0,         0, "do not print filenames, even if multiple files are named on command line" },
+    { "only-matching",       'o', 0,         0, "print only the part of each paragraph that matches, one match per line" },
     { "perl-regexp",         'P', 0,         0, "PATTERN uses Perl syntax" },
+    { "progress",            progress_option, "SECONDS", OPTION_ARG_OPTIONAL, "print the documents done, the throughput, the matches so far, and the time left to the standard error every SECONDS seconds (default 5)" },
+    { "progress-file",       progress_file_option, "FILE", 0, "write the progress reports to FILE as JSON instead of the standard error, replacing it atomically" },
     { "quiet",               'q', 0,         0, "do not write anything; exit status is 0 for a match" },
     { "regexp",              'e', "PATTERN", 0, "match PATTERN; use this option if PATTERN starts with -"},
+    { "scope",               scope_option, "LIST", 0, "search only the paragraphs in LIST, a comma-separated list of headings, tables, notes, annotations, and frames" },
+    { "slow-log",            slow_log_option, "FILE", 0, "record each document that takes longer than --slow-threshold in FILE, with its sizes and the time in each stage, and print the slowest at exit" },
+    { "slow-threshold",      slow_threshold_option, "MS", 0, "a document is slow for --slow-log if it, or one stage of it, takes longer than MS milliseconds (default 1000)" },
+    { "stats",               stats_option, "FORMAT", OPTION_ARG_OPTIONAL, "print counters, the time spent in each stage, and allocation statistics to the standard error at exit (FORMAT is text, json, or prometheus)" },
+    { "stats-file",          stats_file_option, "FILE", 0, "write the statistics to FILE instead of the standard error, replacing it atomically" },
+    { "top",                 top_option, "N", 0, "print only the N most frequent keys for --aggregate, or the N slowest documents for --slow-log" },
+    { "trace",               trace_option, "FILE", 0, "write a timeline of each document and each stage in each thread to FILE, in the Chrome Trace Event format" },
+    { "type",                type_option, "LIST", 0, "search only documents whose type is in LIST, a comma-separated list of text, spreadsheet, presentation, drawing, chart, and formula" },
     { "version",             'V', 0,         0, "print version number and exit" },
+    { "window",              window_option, "SIZE", 0, "match paragraphs longer than SIZE bytes in windows of SIZE characters, to bound memory; SIZE can end with k, M, or G (default 4M)" },
     { "with-filename",       'H', 0,         0, "print filename even if only one file is named on command line" },
     { 0 }
   };
@@ -414,19 +2722,69 @@ int main(int argc, char *argv[])
         "using UTF-32 code points."
   };
 
-  LIBXML_TEST_VERSION;
-  xml::parser parser;
   try {
     argp_parse(&parse_info, argc, argv, 0, 0, 0);
-    if (print_filename == multiple)
-      print_filename = (documents.size() == 1 ? never : always);
+    // The memory hooks must be in place before libxml2 allocates anything.
+    if (use_arena or show_stats)
+      arena::install();
+    if (show_stats)
+      stats::enable();
+    if (trace_file != 0)
+      stats::enable_trace();
+    if (slow_log != 0)
+    {
+      slow_log_fd = open(slow_log, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (slow_log_fd < 0)
+      {
+        perror(slow_log);
+        std::exit(cmdline_error);
+      }
+      stats::enable();
+    }
+    LIBXML_TEST_VERSION;
+    xml::parser parser;
     assert(have_pattern);
-    pattern.assign(utf8_to_utf32(pattern_text), flavor | flags);
+    if (flavor == boost::regex_constants::literal and pattern_text.find('\n') != std::string::npos)
+      pattern.assign(utf8_to_utf32(fixed_strings(pattern_text)), boost::regex_constants::egrep | flags);
+    else
+      pattern.assign(utf8_to_utf32(pattern_text), flavor | flags);
     if (act.get() == 0)
       act.reset(new echo_text);
-    std::for_each(documents.begin(), documents.end(), grep_document);
-    act->finish_all();
+    // -q exits at the first match, and --extractor=compare reports as it goes.
+    if (dynamic_cast<quiet*>(act.get()) != 0 or extractor == compare_extractors)
+      jobs = 1;
+    if (aggregate* a = dynamic_cast<aggregate*>(act.get()))
+      prepare_aggregate(*a);
+    want_positions = act->positions();
+    if (isatty(STDOUT_FILENO))
+      output_buffer::standard().line_buffered(true);
+    if (progress_interval != 0)
+      progress::start(documents.size(), progress_interval, progress_file);
+    bool written = grep_documents();
+    progress::stop();
+    {
+      stats::timer timer(stats::output_stage);
+      act->finish_all();
+      written = output_buffer::standard().flush() and written;
+    }
+    if (not written)
+    {
+      std::cerr << "write error: " << std::strerror(errno) << '\n';
+      status = io_error;
+    }
+    if (show_stats)
+      print_stats();
+    if (trace_file != 0)
+      write_trace();
+    if (slow_log_fd >= 0)
+    {
+      print_slow_documents();
+      close(slow_log_fd);
+    }
+    if (extractors_differ)
+      status = io_error;
   } catch(std::exception& ex) {
+    output_buffer::standard().flush();
     std::cerr << ex.what() << '\n';
     status = io_error;
   }
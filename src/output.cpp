@@ -0,0 +1,219 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/// @file output.cpp
+/// Implement the output buffers.
+
+#include "output.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+extern "C"
+{
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+namespace
+{
+
+/// Ordinary chunks are this large. Longer text gets a chunk of its own.
+std::size_t const chunk_size = 64 * 1024;
+/// A buffer with a file descriptor flushes itself when it holds this much.
+std::size_t const flush_size = 256 * 1024;
+/// At most this many chunks are passed to one writev call.
+std::size_t const max_iov = 64;
+
+__thread output_buffer* current_buffer = 0; ///< the calling thread's redirected output, or null
+
+} // end of namespace
+
+output_buffer::output_buffer(int fd)
+: size_(0), fd_(fd), line_buffered_(false)
+{}
+
+output_buffer::~output_buffer()
+{
+  for (std::vector<chunk>::iterator c = chunks_.begin(); c != chunks_.end(); ++c)
+    std::free(c->data);
+}
+
+void output_buffer::reserve(std::size_t size)
+{
+  chunk c;
+  c.capacity = std::max(chunk_size, size);
+  c.data = static_cast<char*>(std::malloc(c.capacity));
+  if (c.data == 0)
+    throw std::bad_alloc();
+  c.size = 0;
+  chunks_.push_back(c);
+}
+
+void output_buffer::write(char const* text, std::size_t size)
+{
+  if (chunks_.empty() or chunks_.back().capacity - chunks_.back().size < size)
+  {
+    // Fill the last chunk first, so ordinary chunks go out full.
+    if (not chunks_.empty() and size < chunk_size)
+    {
+      chunk& last = chunks_.back();
+      std::size_t const n = last.capacity - last.size;
+      std::memcpy(last.data + last.size, text, n);
+      last.size += n;
+      size_ += n;
+      text += n;
+      size -= n;
+    }
+    reserve(size);
+  }
+  chunk& last = chunks_.back();
+  std::memcpy(last.data + last.size, text, size);
+  last.size += size;
+  size_ += size;
+  if (fd_ >= 0 and size_ >= flush_size)
+    flush();
+}
+
+void output_buffer::end_line()
+{
+  put('\n');
+  if (line_buffered_)
+    flush();
+}
+
+void output_buffer::write_number(long n)
+{
+  char digits[24];
+  char* p = digits + sizeof(digits);
+  unsigned long u = (n < 0 ? -static_cast<unsigned long>(n) : n);
+  do
+    *--p = static_cast<char>('0' + u % 10);
+  while ((u /= 10) != 0);
+  if (n < 0)
+    *--p = '-';
+  write(p, digits + sizeof(digits) - p);
+}
+
+void output_buffer::write_json(std::string const& str)
+{
+  static char const hex[] = "0123456789abcdef";
+  put('"');
+  std::string::size_type start = 0; // the first character not yet written
+  for (std::string::size_type i = 0; i != str.size(); ++i)
+  {
+    unsigned char const c = str[i];
+    if (c >= 0x20 and c != '"' and c != '\\')
+      continue;
+    write(str.data() + start, i - start);
+    start = i + 1;
+    put('\\');
+    switch (c)
+    {
+      case '"':  put('"'); break;
+      case '\\': put('\\'); break;
+      case '\n': put('n'); break;
+      case '\t': put('t'); break;
+      case '\r': put('r'); break;
+      default:
+        write("u00", 3);
+        put(hex[c >> 4]);
+        put(hex[c & 0xf]);
+    }
+  }
+  write(str.data() + start, str.size() - start);
+  put('"');
+}
+
+bool output_buffer::flush()
+{
+  return fd_ < 0 or flush(fd_);
+}
+
+bool output_buffer::flush(int fd)
+{
+  bool result = true;
+  std::size_t first = 0;  // the first chunk that is not completely written
+  std::size_t offset = 0; // bytes of that chunk that were written
+  while (result and first != chunks_.size())
+  {
+    iovec iov[max_iov];
+    std::size_t count = 0;
+    for (std::size_t i = first; i != chunks_.size() and count != max_iov; ++i, ++count)
+    {
+      iov[count].iov_base = chunks_[i].data + (i == first ? offset : 0);
+      iov[count].iov_len = chunks_[i].size - (i == first ? offset : 0);
+    }
+    ssize_t n = ::writev(fd, iov, static_cast<int>(count));
+    if (n < 0)
+    {
+      if (errno != EINTR)
+        result = false;
+      continue;
+    }
+    // Skip past the chunks that were written.
+    for (; first != chunks_.size() and static_cast<std::size_t>(n) >= chunks_[first].size - offset; ++first)
+    {
+      n -= chunks_[first].size - offset;
+      offset = 0;
+    }
+    offset += n;
+  }
+
+  // Keep one ordinary chunk for the next writes.
+  std::size_t kept = 0;
+  for (std::vector<chunk>::iterator c = chunks_.begin(); c != chunks_.end(); ++c)
+    if (kept == 0 and c->capacity == chunk_size)
+    {
+      c->size = 0;
+      chunks_[kept++] = *c;
+    }
+    else
+      std::free(c->data);
+  chunks_.resize(kept);
+  size_ = 0;
+  return result;
+}
+
+output_buffer& output_buffer::standard()
+{
+  static output_buffer buffer(STDOUT_FILENO);
+  return buffer;
+}
+
+output_buffer& output_buffer::current()
+{
+  return current_buffer != 0 ? *current_buffer : standard();
+}
+
+
+output_buffer::scope::scope(output_buffer& buffer)
+: previous_(current_buffer)
+{
+  current_buffer = &buffer;
+}
+
+output_buffer::scope::~scope()
+{
+  current_buffer = previous_;
+}
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file output.hpp
+ * Buffered output for the actions.
+ * Matches are copied into large buffers, and the buffers are written
+ * with writev, a few hundred kilobytes at a time, instead of going through
+ * iostreams one field at a time. A thread can redirect its output into
+ * a buffer of its own, which is written later, in order with the output
+ * of other threads.
+ */
+
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/** Text that is waiting to be written to a file descriptor.
+ * The text is kept in a list of chunks, so the buffer grows without
+ * copying what it already holds, and flush() writes every chunk with
+ * one writev call.
+ */
+class output_buffer
+{
+public:
+  /// Construct an empty buffer.
+  /// @param fd the file descriptor that the buffer flushes itself to
+  /// when it grows large, or -1 for a buffer that grows until flush(int)
+  explicit output_buffer(int fd = -1);
+  ~output_buffer();
+
+  /// Append text to the buffer.
+  /// @param text the text to append
+  /// @param size the number of bytes in @p text
+  void write(char const* text, std::size_t size);
+  /// Append text to the buffer.
+  /// @param text the text to append
+  void write(std::string const& text) { write(text.data(), text.size()); }
+  /// Append one character to the buffer.
+  /// @param c the character to append
+  void put(char c);
+  /// Append a newline to the buffer, and flush the buffer if it is line buffered.
+  void end_line();
+  /// Append a number to the buffer, in decimal.
+  /// @param n the number to append
+  void write_number(long n);
+  /// Append a string as a JSON string, in quotes, with the characters
+  /// that JSON forbids escaped. Other characters, including non-ASCII
+  /// UTF-8, are copied as they are.
+  /// @param str the string to append
+  void write_json(std::string const& str);
+
+  /// @returns the number of bytes in the buffer
+  std::size_t size() const { return size_; }
+  /// Flush the buffer to its file descriptor at the end of each line,
+  /// as for a terminal.
+  /// @param on true to flush at the end of each line
+  void line_buffered(bool on) { line_buffered_ = on; }
+
+  /// Write the buffer to its own file descriptor and empty it.
+  /// @returns false if writing failed, with errno set
+  bool flush();
+  /// Write the buffer to a file descriptor and empty it.
+  /// @param fd the file descriptor
+  /// @returns false if writing failed, with errno set
+  bool flush(int fd);
+
+  /// @returns the buffer for the standard output
+  static output_buffer& standard();
+  /// @returns the calling thread's output buffer: the buffer of the
+  /// innermost output_buffer::scope, or the standard output buffer
+  static output_buffer& current();
+
+  /** Redirect the calling thread's output into a buffer.
+   */
+  class scope
+  {
+  public:
+    /// Make @p buffer the current buffer.
+    /// @param buffer receives the output until the scope ends
+    explicit scope(output_buffer& buffer);
+    /// Restore the previous buffer.
+    ~scope();
+  private:
+    scope(scope const&);          ///< not implemented
+    void operator=(scope const&); ///< not implemented
+    output_buffer* previous_;     ///< the buffer that was current before the scope
+  };
+
+private:
+  /// One block of text.
+  struct chunk
+  {
+    char* data;           ///< start of the chunk
+    std::size_t size;     ///< number of bytes in use
+    std::size_t capacity; ///< number of bytes in the chunk
+  };
+
+  output_buffer(output_buffer const&);  ///< not implemented
+  void operator=(output_buffer const&); ///< not implemented
+
+  /// Make room for at least @p size more bytes in the last chunk.
+  void reserve(std::size_t size);
+
+  std::vector<chunk> chunks_; ///< the text, in order; the last chunk has room to grow
+  std::size_t size_;          ///< the number of bytes in all chunks
+  int fd_;                    ///< where the buffer flushes itself, or -1
+  bool line_buffered_;        ///< true to flush at the end of each line
+};
+
+inline void output_buffer::put(char c)
+{
+  if (chunks_.empty() or chunks_.back().size == chunks_.back().capacity)
+    reserve(1);
+  chunks_.back().data[chunks_.back().size++] = c;
+  ++size_;
+}
+
+#endif
@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/// @file progress.cpp
+/// Implement the counters and the reporter thread for --progress.
+
+#include "progress.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "stats.hpp"
+
+namespace
+{
+
+unsigned long done_count = 0;           ///< documents named on the command line that are done
+unsigned long document_count = 0;       ///< documents searched, including the members of bundles
+unsigned long long byte_count = 0;      ///< bytes of XML searched
+unsigned long match_count = 0;          ///< matches found
+unsigned long total_documents = 0;      ///< documents named on the command line
+unsigned interval = 0;                  ///< seconds between reports
+char const* status_file = 0;            ///< where to write the reports, or null for the standard error
+unsigned long long start_time = 0;      ///< when the run started, in nanoseconds
+boost::thread* reporter = 0;            ///< the thread that prints the reports
+
+/// Read a counter that other threads add to.
+template<class T>
+inline T load(T& counter)
+{
+  return __sync_add_and_fetch(&counter, 0);
+}
+
+/** Print one report, to the standard error or the status file.
+ * The rates are averages since the run started, and the estimate of the
+ * time left assumes the remaining documents go at the same rate.
+ */
+void report()
+{
+  unsigned long const done = load(done_count);
+  unsigned long const documents = load(document_count);
+  unsigned long long const bytes = load(byte_count);
+  unsigned long const matches = load(match_count);
+  double const seconds = (stats::now() - start_time) / 1e9;
+  double const byte_rate = (seconds > 0 ? bytes / seconds : 0);
+  double const document_rate = (seconds > 0 ? done / seconds : 0);
+  long const left = (done == 0 ? -1 : static_cast<long>((total_documents - done) / document_rate));
+
+  char line[256];
+  if (status_file == 0)
+  {
+    char eta[32] = "--:--:--";
+    if (left >= 0)
+      std::sprintf(eta, "%ld:%02ld:%02ld", left / 3600, left / 60 % 60, left % 60);
+    std::sprintf(line, "progress: %lu/%lu documents, %.1f MB, %.1f MB/s, %.1f documents/s, %lu matches, ETA %s\n",
+                 done, total_documents, bytes / 1e6, byte_rate / 1e6, document_rate, matches, eta);
+    std::cerr << line << std::flush;
+    return;
+  }
+
+  std::sprintf(line, "{\"done\":%lu,\"total\":%lu,\"documents\":%lu,\"bytes\":%llu,\"matches\":%lu,"
+                     "\"elapsed_seconds\":%.3f,\"bytes_per_second\":%.0f,\"documents_per_second\":%.3f,"
+                     "\"eta_seconds\":%ld}\n",
+               done, total_documents, documents, bytes, matches, seconds, byte_rate, document_rate, left);
+  std::string const temporary = std::string(status_file) + ".tmp";
+  std::ofstream out(temporary.c_str());
+  out << line;
+  out.close();
+  if (not out or std::rename(temporary.c_str(), status_file) != 0)
+    std::cerr << status_file << ": " << std::strerror(errno) << '\n';
+}
+
+/// The body of the reporter thread, which runs until it is interrupted.
+void run()
+{
+  try
+  {
+    for (;;)
+    {
+      boost::this_thread::sleep(boost::posix_time::seconds(interval));
+      report();
+    }
+  }
+  catch (boost::thread_interrupted const&)
+  {}
+}
+
+} // end of namespace
+
+bool progress::enabled_ = false;
+
+void progress::start(unsigned long total, unsigned seconds, char const* file)
+{
+  total_documents = total;
+  interval = seconds;
+  status_file = file;
+  start_time = stats::now();
+  enabled_ = true;
+  reporter = new boost::thread(run);
+}
+
+void progress::stop()
+{
+  if (reporter == 0)
+    return;
+  reporter->interrupt();
+  reporter->join();
+  delete reporter;
+  reporter = 0;
+  report();
+}
+
+void progress::add_document(unsigned long long bytes, unsigned long matches)
+{
+  __sync_fetch_and_add(&document_count, 1);
+  __sync_fetch_and_add(&byte_count, bytes);
+  __sync_fetch_and_add(&match_count, matches);
+}
+
+void progress::add_done()
+{
+  __sync_fetch_and_add(&done_count, 1);
+}
@@ -0,0 +1,70 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file progress.hpp
+ * Periodic progress reports for --progress.
+ * The searching threads add to a few counters with atomic operations
+ * when each document is done, and a reporter thread wakes up at a fixed
+ * interval to read them and print a report. Nothing is formatted and no
+ * lock is taken while a document is searched.
+ */
+
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+/// Progress of the whole run, for --progress.
+class progress
+{
+public:
+  /** Start the reporter thread.
+   * @param total the number of documents named on the command line
+   * @param seconds the interval between reports
+   * @param file write each report to this file, replacing the previous one,
+   * or null to print the reports to the standard error
+   */
+  static void start(unsigned long total, unsigned seconds, char const* file);
+  /// Stop the reporter thread, and print a last report.
+  /// Does nothing if start() was not called.
+  static void stop();
+  /// Test whether --progress asked for reports.
+  static bool enabled() { return enabled_; }
+
+  /// Count a document that was searched, which may be a member of a bundle.
+  /// @param bytes the number of bytes of XML in the document
+  /// @param matches the number of matches in the document
+  static void add(unsigned long long bytes, unsigned long matches)
+  {
+    if (enabled_)
+      add_document(bytes, matches);
+  }
+  /// Count one of the documents that were named on the command line, when it is done.
+  static void done()
+  {
+    if (enabled_)
+      add_done();
+  }
+
+private:
+  static void add_document(unsigned long long bytes, unsigned long matches);
+  static void add_done();
+  static bool enabled_; ///< true after start()
+};
+
+#endif
@@ -0,0 +1,641 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/// @file scanner.cpp
+/// Implement the ODF paragraph scanner.
+
+#include "scanner.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace odf
+{
+
+namespace
+{
+
+/// Test for an XML whitespace character.
+inline bool is_space(char c)
+{
+  return c == ' ' or c == '\t' or c == '\n' or c == '\r';
+}
+
+/// Find a character.
+/// @returns a pointer to the first @p c in [@p p, @p end), or @p end
+inline char const* find(char const* p, char const* end, char c)
+{
+  void const* result = std::memchr(p, c, end - p);
+  return result == 0 ? end : static_cast<char const*>(result);
+}
+
+/// Find a string.
+/// @returns a pointer to the first occurrence of @p str in [@p p, @p end), or @p end
+char const* find(char const* p, char const* end, char const* str)
+{
+  std::size_t size = std::strlen(str);
+  for (p = find(p, end, str[0]); static_cast<std::size_t>(end - p) >= size; p = find(p + 1, end, str[0]))
+    if (std::memcmp(p, str, size) == 0)
+      return p;
+  return end;
+}
+
+/// Test whether [@p p, @p end) starts with @p str.
+inline bool starts_with(char const* p, char const* end, char const* str)
+{
+  std::size_t size = std::strlen(str);
+  return static_cast<std::size_t>(end - p) >= size and std::memcmp(p, str, size) == 0;
+}
+
+/** Find the next character that ends a run of character data.
+ * Inside a paragraph, the scanner must stop at '<' for markup, '&' for
+ * references, and '\\r' for line-end normalization. With SSE2, sixteen bytes
+ * are compared at a time. Outside paragraphs, only '<' matters, and memchr
+ * is already as fast as anything written here.
+ * @returns a pointer to the first '<', '&', or '\\r' in [@p p, @p end), or @p end
+ */
+inline char const* find_markup(char const* p, char const* end)
+{
+#ifdef __SSE2__
+  __m128i const lt  = _mm_set1_epi8('<');
+  __m128i const amp = _mm_set1_epi8('&');
+  __m128i const cr  = _mm_set1_epi8('\r');
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+    __m128i const hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, amp)),
+                                      _mm_cmpeq_epi8(chunk, cr));
+    int const mask = _mm_movemask_epi8(hits);
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p != end; ++p)
+    if (*p == '<' or *p == '&' or *p == '\r')
+      return p;
+  return end;
+}
+
+/// Encode a code point as UTF-8.
+/// @param code the code point, which must be valid
+/// @param buffer room for at least four bytes
+/// @returns the number of bytes stored in @p buffer
+std::size_t to_utf8(unsigned long code, char* buffer)
+{
+  if (code < 0x80)
+  {
+    buffer[0] = static_cast<char>(code);
+    return 1;
+  }
+  else if (code < 0x800)
+  {
+    buffer[0] = static_cast<char>(0xc0 | (code >> 6));
+    buffer[1] = static_cast<char>(0x80 | (code & 0x3f));
+    return 2;
+  }
+  else if (code < 0x10000)
+  {
+    buffer[0] = static_cast<char>(0xe0 | (code >> 12));
+    buffer[1] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    buffer[2] = static_cast<char>(0x80 | (code & 0x3f));
+    return 3;
+  }
+  else
+  {
+    buffer[0] = static_cast<char>(0xf0 | (code >> 18));
+    buffer[1] = static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+    buffer[2] = static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    buffer[3] = static_cast<char>(0x80 | (code & 0x3f));
+    return 4;
+  }
+}
+
+/// Decode the references in an attribute value and normalize its white space.
+/// The value has already been checked for a closing quote, but not for
+/// well-formed references, which are copied as they are.
+std::string attribute_value(char const* p, char const* end)
+{
+  std::string result;
+  while (p != end)
+  {
+    if (*p == '&')
+    {
+      char const* semicolon = find(p, end, ';');
+      std::string const name(p + 1, semicolon);
+      if (name == "lt")
+        result += '<';
+      else if (name == "gt")
+        result += '>';
+      else if (name == "amp")
+        result += '&';
+      else if (name == "quot")
+        result += '"';
+      else if (name == "apos")
+        result += '\'';
+      else if (name.size() >= 2 and name[0] == '#')
+      {
+        unsigned long const code = (name[1] == 'x' ? std::strtoul(name.c_str() + 2, 0, 16)
+                                                    : std::strtoul(name.c_str() + 1, 0, 10));
+        char buffer[4];
+        if (code != 0 and code <= 0x10ffff and (code < 0xd800 or code > 0xdfff))
+          result.append(buffer, to_utf8(code, buffer));
+      }
+      else
+        result.append(p, semicolon);
+      p = (semicolon == end ? end : semicolon + 1);
+    }
+    else if (*p == '\r')
+    {
+      result += ' ';
+      if (++p != end and *p == '\n')
+        ++p;
+    }
+    else if (*p == '\n' or *p == '\t')
+    {
+      result += ' ';
+      ++p;
+    }
+    else
+      result += *p++;
+  }
+  return result;
+}
+
+} // end of namespace
+
+
+scanner::scanner(unsigned scope, bool search_deleted)
+: selector_(scope, search_deleted), begin_(0), pos_(0), end_(0), sink_(0),
+  body_depth_(0), text_depth_(0), paragraph_depth_(0), skip_depth_(0), done_(false),
+  span_(0), span_size_(0)
+{}
+
+bool scanner::scan(char const* buffer, std::size_t size, paragraph_sink& sink)
+{
+  begin_ = pos_ = buffer;
+  end_ = buffer + size;
+  sink_ = &sink;
+  bindings_.clear();
+  elements_.clear();
+  body_depth_ = text_depth_ = paragraph_depth_ = skip_depth_ = 0;
+  done_ = false;
+  selector_.reset();
+  text_.clear();
+  span_ = 0;
+
+  prolog();
+  while (not done_)
+  {
+    if (paragraph_depth_ != 0)
+    {
+      char const* p = find_markup(pos_, end_);
+      append(pos_, p - pos_);
+      pos_ = p;
+      if (pos_ == end_)
+        break;
+      if (*pos_ == '&')
+      {
+        reference();
+        continue;
+      }
+      if (*pos_ == '\r')
+      {
+        // A CR or CR-LF pair is a single line feed.
+        append("\n", 1);
+        if (++pos_ != end_ and *pos_ == '\n')
+          ++pos_;
+        continue;
+      }
+    }
+    else
+    {
+      pos_ = find(pos_, end_, '<');
+      if (pos_ == end_)
+        break;
+    }
+
+    if (end_ - pos_ < 2)
+      malformed("unexpected end of stream");
+    if (pos_[1] == '/')
+    {
+      pos_ += 2;
+      if (not end_tag())
+        return false;
+    }
+    else if (pos_[1] == '!' or pos_[1] == '?')
+      skip_special();
+    else
+    {
+      ++pos_;
+      if (not start_tag())
+        return false;
+    }
+  }
+  if (not done_)
+    malformed("unexpected end of stream");
+  return true;
+}
+
+void scanner::prolog()
+{
+  if (starts_with(pos_, end_, "\xef\xbb\xbf"))
+    pos_ += 3;
+  else if (end_ - pos_ >= 2 and (pos_[0] == '\0' or pos_[1] == '\0' or
+           starts_with(pos_, end_, "\xfe\xff") or starts_with(pos_, end_, "\xff\xfe")))
+    throw unsupported("stream is not UTF-8");
+
+  if (starts_with(pos_, end_, "<?xml") and end_ - pos_ > 5 and is_space(pos_[5]))
+  {
+    char const* decl_end = find(pos_, end_, "?>");
+    if (decl_end == end_)
+      malformed("unterminated XML declaration");
+    char const* encoding = find(pos_, decl_end, "encoding");
+    if (encoding != decl_end)
+    {
+      char const* quote = encoding + 8;
+      while (quote != decl_end and *quote != '"' and *quote != '\'')
+        ++quote;
+      if (quote == decl_end)
+        malformed("bad encoding declaration");
+      char const* value = quote + 1;
+      char const* value_end = find(value, decl_end, *quote);
+      std::string name(value, value_end);
+      for (std::string::iterator c = name.begin(); c != name.end(); ++c)
+        *c = std::toupper(static_cast<unsigned char>(*c));
+      if (name != "UTF-8" and name != "UTF8")
+        throw unsupported("encoding " + std::string(value, value_end));
+    }
+    pos_ = decl_end + 2;
+  }
+
+  for (;;)
+  {
+    while (pos_ != end_ and is_space(*pos_))
+      ++pos_;
+    if (starts_with(pos_, end_, "<!DOCTYPE"))
+      throw unsupported("document type declaration");
+    else if (starts_with(pos_, end_, "<!") or starts_with(pos_, end_, "<?"))
+      skip_special();
+    else
+      break;
+  }
+}
+
+bool scanner::start_tag()
+{
+  char const* name = pos_;
+  while (pos_ != end_ and not is_space(*pos_) and *pos_ != '>' and *pos_ != '/')
+    ++pos_;
+  if (pos_ == name)
+    malformed("missing element name");
+  std::size_t const name_size = pos_ - name;
+  std::size_t const depth = elements_.size() + 1;
+
+  // Only the selector needs attributes, and only to track spreadsheet cells.
+  bool const record = (paragraph_depth_ == 0 and skip_depth_ == 0 and selector_.where() != 0);
+  attributes_.clear();
+  bool empty = false;
+  for (;;)
+  {
+    while (pos_ != end_ and is_space(*pos_))
+      ++pos_;
+    if (pos_ == end_)
+      malformed("unexpected end of stream");
+    if (*pos_ == '>')
+    {
+      ++pos_;
+      break;
+    }
+    if (*pos_ == '/')
+    {
+      if (end_ - pos_ < 2 or pos_[1] != '>')
+        malformed("expected />");
+      pos_ += 2;
+      empty = true;
+      break;
+    }
+
+    char const* attr = pos_;
+    while (pos_ != end_ and *pos_ != '=' and not is_space(*pos_) and *pos_ != '>' and *pos_ != '/')
+      ++pos_;
+    std::size_t const attr_size = pos_ - attr;
+    while (pos_ != end_ and is_space(*pos_))
+      ++pos_;
+    if (pos_ == end_ or *pos_ != '=')
+      malformed("expected =");
+    ++pos_;
+    while (pos_ != end_ and is_space(*pos_))
+      ++pos_;
+    if (pos_ == end_ or (*pos_ != '"' and *pos_ != '\''))
+      malformed("expected quoted attribute value");
+    char const* value = pos_ + 1;
+    pos_ = find(value, end_, *pos_);
+    if (pos_ == end_)
+      malformed("unterminated attribute value");
+    std::size_t const value_size = pos_ - value;
+    ++pos_;
+
+    if (record)
+    {
+      attribute a = { attr, attr_size, value, value_size };
+      attributes_.push_back(a);
+    }
+
+    if (attr_size >= 5 and std::memcmp(attr, "xmlns", 5) == 0 and (attr_size == 5 or attr[5] == ':'))
+    {
+      binding b;
+      b.prefix = (attr_size == 5 ? attr + 5 : attr + 6);
+      b.size = (attr_size == 5 ? 0 : attr_size - 6);
+      b.uri = namespace_of(value, value_size);
+      b.depth = depth;
+      bindings_.push_back(b);
+    }
+  }
+
+  open_element e = { name, name_size };
+  elements_.push_back(e);
+
+  // Mirror the tree walk: find the <office:master-styles> child of the root,
+  // if any, and the first <office:body> child and its first <office:text>
+  // child, and then let the selector pick paragraphs in each.
+  if (paragraph_depth_ == 0 and skip_depth_ == 0)
+  {
+    element const kind = classify(name, name_size);
+    if (text_depth_ != 0)
+    {
+      switch (selector_.enter(kind, *this))
+      {
+        case extract:
+          paragraph_depth_ = depth;
+          break;
+        case skip:
+          skip_depth_ = depth;
+          break;
+        case descend:
+          break;
+      }
+    }
+    else if (body_depth_ != 0)
+    {
+      if (depth == body_depth_ + 1 and is_body(kind))
+      {
+        text_depth_ = depth;
+        selector_.begin(kind);
+        sink_->locate(selector_.where());
+      }
+    }
+    else if (depth == 2 and kind == office_body)
+      body_depth_ = depth;
+    else if (depth == 2 and kind == office_master_styles)
+    {
+      text_depth_ = depth;
+      selector_.begin(kind);
+      sink_->locate(selector_.where());
+    }
+  }
+
+  if (empty)
+    return close_element();
+  return true;
+}
+
+bool scanner::end_tag()
+{
+  char const* name = pos_;
+  while (pos_ != end_ and not is_space(*pos_) and *pos_ != '>')
+    ++pos_;
+  std::size_t const name_size = pos_ - name;
+  while (pos_ != end_ and is_space(*pos_))
+    ++pos_;
+  if (pos_ == end_ or *pos_ != '>')
+    malformed("expected >");
+  ++pos_;
+  if (elements_.empty() or elements_.back().size != name_size or
+      std::memcmp(elements_.back().name, name, name_size) != 0)
+    malformed("mismatched end tag");
+  return close_element();
+}
+
+bool scanner::close_element()
+{
+  std::size_t const depth = elements_.size();
+  bool result = true;
+  if (paragraph_depth_ == depth)
+  {
+    paragraph_depth_ = 0;
+    result = emit();
+  }
+  else if (skip_depth_ == depth)
+    skip_depth_ = 0;
+  else if (text_depth_ == depth and body_depth_ == 0)
+    text_depth_ = 0; // the master styles end, and the body may follow
+  else if (text_depth_ == depth or body_depth_ == depth)
+    done_ = true; // nothing after the body text is searched
+  else if (text_depth_ != 0 and depth > text_depth_ and paragraph_depth_ == 0 and skip_depth_ == 0)
+    selector_.leave();
+
+  while (not bindings_.empty() and bindings_.back().depth == depth)
+    bindings_.pop_back();
+  elements_.pop_back();
+  if (elements_.empty())
+    done_ = true;
+  return result;
+}
+
+void scanner::skip_special()
+{
+  if (starts_with(pos_, end_, "<!--"))
+  {
+    char const* end = find(pos_ + 4, end_, "-->");
+    if (end == end_)
+      malformed("unterminated comment");
+    pos_ = end + 3;
+  }
+  else if (starts_with(pos_, end_, "<![CDATA["))
+  {
+    char const* text = pos_ + 9;
+    char const* end = find(text, end_, "]]>");
+    if (end == end_)
+      malformed("unterminated CDATA section");
+    if (paragraph_depth_ != 0)
+    {
+      for (char const* cr = find(text, end, '\r'); cr != end; cr = find(text, end, '\r'))
+      {
+        append(text, cr - text);
+        append("\n", 1);
+        text = (cr + 1 != end and cr[1] == '\n' ? cr + 2 : cr + 1);
+      }
+      append(text, end - text);
+    }
+    pos_ = end + 3;
+  }
+  else if (starts_with(pos_, end_, "<?"))
+  {
+    char const* end = find(pos_ + 2, end_, "?>");
+    if (end == end_)
+      malformed("unterminated processing instruction");
+    pos_ = end + 2;
+  }
+  else
+    malformed("unexpected declaration");
+}
+
+void scanner::reference()
+{
+  char const* name = pos_ + 1;
+  char const* semicolon = find(name, end_, ';');
+  if (semicolon == end_)
+    malformed("unterminated reference");
+  std::size_t const size = semicolon - name;
+
+  if (size >= 2 and name[0] == '#')
+  {
+    bool const hex = (name[1] == 'x');
+    char const* digit = name + (hex ? 2 : 1);
+    if (digit == semicolon)
+      malformed("empty character reference");
+    unsigned long code = 0;
+    for (; digit != semicolon; ++digit)
+    {
+      unsigned value = 0;
+      if (*digit >= '0' and *digit <= '9')
+        value = *digit - '0';
+      else if (hex and *digit >= 'a' and *digit <= 'f')
+        value = *digit - 'a' + 10;
+      else if (hex and *digit >= 'A' and *digit <= 'F')
+        value = *digit - 'A' + 10;
+      else
+        malformed("bad character reference");
+      code = code * (hex ? 16 : 10) + value;
+      if (code > 0x10ffff)
+        malformed("character reference out of range");
+    }
+    if (code == 0 or (code >= 0xd800 and code <= 0xdfff))
+      malformed("character reference out of range");
+
+    // The encoded character lives on the stack, so it must be copied.
+    char buffer[4];
+    if (span_ != 0)
+    {
+      text_.assign(span_, span_size_);
+      span_ = 0;
+    }
+    text_.append(buffer, to_utf8(code, buffer));
+  }
+  else if (size == 2 and std::memcmp(name, "lt", 2) == 0)
+    append("<", 1);
+  else if (size == 2 and std::memcmp(name, "gt", 2) == 0)
+    append(">", 1);
+  else if (size == 3 and std::memcmp(name, "amp", 3) == 0)
+    append("&", 1);
+  else if (size == 4 and std::memcmp(name, "quot", 4) == 0)
+    append("\"", 1);
+  else if (size == 4 and std::memcmp(name, "apos", 4) == 0)
+    append("'", 1);
+  else
+    malformed("undefined entity");
+
+  pos_ = semicolon + 1;
+}
+
+element scanner::classify(char const* name, std::size_t size)
+const
+{
+  char const* colon = static_cast<char const*>(std::memchr(name, ':', size));
+  char const* local = (colon == 0 ? name : colon + 1);
+
+  // Look at the local name first, so the prefix is resolved only for
+  // the handful of elements that matter.
+  ns uri;
+  element const kind = lookup(local, size - (local - name), uri);
+  if (kind == other_element or resolve(name, colon == 0 ? 0 : colon - name) != uri)
+    return other_element;
+  return kind;
+}
+
+ns scanner::resolve(char const* prefix, std::size_t size)
+const
+{
+  for (std::vector<binding>::const_reverse_iterator b = bindings_.rbegin(); b != bindings_.rend(); ++b)
+    if (b->size == size and std::memcmp(b->prefix, prefix, size) == 0)
+      return b->uri;
+  return other_ns;
+}
+
+bool scanner::get(ns uri, char const* local_name, std::string& value)
+const
+{
+  std::size_t const size = std::strlen(local_name);
+  for (std::vector<attribute>::const_iterator a = attributes_.begin(); a != attributes_.end(); ++a)
+  {
+    // An attribute without a prefix is in no namespace.
+    char const* colon = static_cast<char const*>(std::memchr(a->name, ':', a->size));
+    if (colon == 0 or a->name + a->size - (colon + 1) != static_cast<std::ptrdiff_t>(size) or
+        std::memcmp(colon + 1, local_name, size) != 0 or resolve(a->name, colon - a->name) != uri)
+      continue;
+    value = attribute_value(a->value, a->value + a->value_size);
+    return true;
+  }
+  return false;
+}
+
+void scanner::append(char const* text, std::size_t size)
+{
+  if (size == 0)
+    return;
+  // The common paragraph is a single run of text, which is passed to the
+  // sink straight from the stream without copying it.
+  if (span_ == 0 and text_.empty())
+  {
+    span_ = text;
+    span_size_ = size;
+    return;
+  }
+  if (span_ != 0)
+  {
+    text_.assign(span_, span_size_);
+    span_ = 0;
+  }
+  text_.append(text, size);
+}
+
+bool scanner::emit()
+{
+  bool const result = (span_ != 0 ? sink_->paragraph(span_, span_size_) : sink_->paragraph(text_.data(), text_.size()));
+  span_ = 0;
+  text_.clear();
+  return result;
+}
+
+void scanner::malformed(char const* what)
+const
+{
+  std::ostringstream msg;
+  msg << "XML is not well-formed: " << what << " at byte " << (pos_ - begin_);
+  throw std::runtime_error(msg.str());
+}
+
+}
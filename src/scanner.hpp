@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file scanner.hpp
+ * A hand-written tokenizer that extracts paragraphs from an ODF content stream.
+ * It understands just enough XML to find paragraph boundaries in a
+ * UTF-8 stream without a DTD, which is what every ODF producer writes.
+ * Anything else is left to libxml2.
+ */
+
+#ifndef SCANNER_HPP
+#define SCANNER_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "odf.hpp"
+
+namespace odf
+{
+  /** Extract paragraphs from the \<office:text\> body of a content stream,
+   * or from the page headers and footers in \<office:master-styles\>.
+   * The scanner finds the same paragraphs as the libxml2 tree walk in
+   * odfgrep.cpp: every \<text:p\> and \<text:h\> that the odf::selector
+   * picks, skipping every subtree that it prunes without classifying
+   * the elements inside. The text
+   * of a paragraph is the concatenation of all the character data inside it,
+   * with predefined entities and character references decoded.
+   *
+   * Element names are matched by namespace URI, not by prefix, so a
+   * document can bind the ODF namespaces to any prefix it likes.
+   */
+  class scanner : private attributes
+  {
+  public:
+    /// Thrown before any paragraph is extracted if the stream uses XML
+    /// features that the scanner does not implement, such as a DTD or
+    /// an encoding other than UTF-8. The caller should use libxml2 instead.
+    struct unsupported : std::runtime_error
+    {
+      /// Construct the exception.
+      /// @param msg describes the unsupported feature
+      unsupported(std::string const& msg) : std::runtime_error(msg) {}
+    };
+
+    /// Construct a scanner.
+    /// @param scope the structures to search, as a bitwise-or of odf::scope values
+    /// @param search_deleted true to extract paragraphs inside \<text:deletion\>
+    scanner(unsigned scope, bool search_deleted);
+
+    /** Scan a content stream.
+     * @param buffer the stream contents
+     * @param size the number of bytes in @p buffer
+     * @param sink receives each paragraph
+     * @return false if @p sink asked to stop, true otherwise
+     * @throw unsupported if the stream must be parsed by libxml2
+     * @throw std::runtime_error if the stream is not well-formed
+     */
+    bool scan(char const* buffer, std::size_t size, paragraph_sink& sink);
+
+  private:
+    /// A namespace prefix that is in scope.
+    struct binding
+    {
+      char const* prefix; ///< the prefix, which is empty for the default namespace
+      std::size_t size;   ///< the number of bytes in @c prefix
+      ns uri;             ///< the namespace that @c prefix stands for
+      std::size_t depth;  ///< depth of the element that declared the binding
+    };
+
+    /// An attribute of the current start tag, as it appears in the stream.
+    struct attribute
+    {
+      char const* name;       ///< the qualified name
+      std::size_t size;       ///< the number of bytes in @c name
+      char const* value;      ///< the value, with references not yet decoded
+      std::size_t value_size; ///< the number of bytes in @c value
+    };
+
+    /// An element whose end tag has not yet been seen.
+    struct open_element
+    {
+      char const* name;  ///< the qualified name from the start tag
+      std::size_t size;  ///< the number of bytes in @c name
+    };
+
+    scanner(scanner const&);        ///< not implemented
+    void operator=(scanner const&); ///< not implemented
+
+    /// Check the XML declaration and skip the prolog.
+    /// @throw unsupported for a DTD or foreign encoding
+    void prolog();
+    /// Parse a start tag or empty-element tag. @c pos_ points after the '<'.
+    /// @returns false if the sink asked to stop
+    bool start_tag();
+    /// Parse an end tag. @c pos_ points after the "</".
+    /// @returns false if the sink asked to stop
+    bool end_tag();
+    /// Handle the end of the element at the top of the stack.
+    /// @returns false if the sink asked to stop
+    bool close_element();
+    /// Skip a comment, CDATA section, or processing instruction.
+    /// @c pos_ points to the '<'. CDATA inside a paragraph is kept.
+    void skip_special();
+    /// Decode an entity or character reference. @c pos_ points to the '&'.
+    void reference();
+    /// Classify an element by its qualified name and the bindings in scope.
+    element classify(char const* name, std::size_t size) const;
+    /// Look up the namespace for a prefix.
+    ns resolve(char const* prefix, std::size_t size) const;
+    /// Get an attribute of the current start tag, for the selector.
+    virtual bool get(ns uri, char const* local_name, std::string& value) const;
+
+    /// Add character data to the current paragraph.
+    void append(char const* text, std::size_t size);
+    /// Pass the current paragraph to the sink and clear it.
+    bool emit();
+
+    /// Throw an exception for a stream that is not well-formed.
+    void malformed(char const* what) const;
+
+    selector selector_;             ///< picks paragraphs inside \<office:text\>
+    char const* begin_;             ///< start of the stream
+    char const* pos_;               ///< current position in the stream
+    char const* end_;               ///< end of the stream
+    paragraph_sink* sink_;          ///< receives paragraphs
+    std::vector<binding> bindings_; ///< prefixes in scope, innermost last
+    std::vector<open_element> elements_; ///< open elements, innermost last
+    std::vector<attribute> attributes_;  ///< attributes of the current start tag, in a spreadsheet
+    std::size_t body_depth_;        ///< depth of \<office:body\>, or 0
+    std::size_t text_depth_;        ///< depth of the body text, such as \<office:text\> or \<office:master-styles\>, or 0
+    std::size_t paragraph_depth_;   ///< depth of the paragraph being extracted, or 0
+    std::size_t skip_depth_;        ///< depth of the subtree being skipped, or 0
+    bool done_;                     ///< true after \<office:text\> ends
+    std::string text_;              ///< paragraph text that had to be copied
+    char const* span_;              ///< paragraph text that has not been copied yet
+    std::size_t span_size_;         ///< number of bytes at @c span_
+  };
+}
+
+#endif
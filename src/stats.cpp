@@ -0,0 +1,462 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/// @file stats.cpp
+/// Implement the counters and stage timers for --stats, the report, and the trace.
+
+#include "stats.hpp"
+
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include "arena.hpp"
+#include "output.hpp"
+
+namespace
+{
+
+/// The name of each stage, in the report.
+char const* const stage_names[stats::stage_count] = {
+  "open", "inflate", "parse", "extract", "convert", "match", "output"
+};
+
+/// The name of each counter, in the JSON and Prometheus reports.
+char const* const counter_names[stats::counter_count] = {
+  "documents", "compressed_bytes", "inflated_bytes", "flat_bytes", "paragraphs", "matches"
+};
+
+/// The label of each counter, in the table.
+char const* const counter_labels[stats::counter_count] = {
+  "documents searched:       ",
+  "compressed bytes read:    ",
+  "inflated bytes:           ",
+  "flat document bytes:      ",
+  "paragraphs extracted:     ",
+  "matches reported:         "
+};
+
+/// The help text of each counter, in the Prometheus report.
+char const* const counter_help[stats::counter_count] = {
+  "Documents searched.",
+  "Bytes of package streams before they were inflated.",
+  "Bytes of package streams after they were inflated.",
+  "Bytes of flat documents.",
+  "Paragraphs extracted from the documents.",
+  "Matches reported."
+};
+
+__thread stats::totals_type local_totals;   ///< the calling thread's counters, not yet folded into @c global_totals
+__thread int current_stage = -1;            ///< the stage that the calling thread is timing, or -1
+__thread unsigned long long stage_start;    ///< when the calling thread started or resumed @c current_stage
+stats::totals_type global_totals;           ///< counters from all threads
+boost::mutex totals_mutex;                  ///< protects @c global_totals
+
+/// Each thread keeps at most this many spans of stages for the trace.
+std::size_t const trace_capacity = 256 * 1024;
+
+/// A span of a stage, in the trace.
+struct stage_span
+{
+  unsigned long long begin; ///< when the stage started, in nanoseconds
+  unsigned long long end;   ///< when the stage ended, in nanoseconds
+  stats::stage stage;       ///< the stage
+};
+
+/// A span of a document, in the trace.
+struct named_span
+{
+  unsigned long long begin; ///< when the document's search started, in nanoseconds
+  unsigned long long end;   ///< when the document's search ended, in nanoseconds
+  std::string name;         ///< the document's name
+};
+
+/// The spans that one thread recorded.
+/// The spans of stages are a ring, which drops the oldest when it is full.
+struct thread_trace
+{
+  thread_trace(unsigned id) : id(id), next(0), dropped(0) {}
+  unsigned id;                     ///< the thread's number in the trace, from 1
+  std::vector<stage_span> stages;  ///< the spans of stages; @c next is the oldest once it is full
+  std::size_t next;                ///< where the next span goes once @c stages is full
+  unsigned long long dropped;      ///< the number of spans that were overwritten
+  std::vector<named_span> documents; ///< the span of every document
+};
+
+__thread thread_trace* local_trace = 0;     ///< the calling thread's spans
+std::vector<thread_trace*> traces;          ///< the spans of every thread, in the order the threads started
+boost::mutex traces_mutex;                  ///< protects @c traces
+unsigned long long trace_origin;            ///< when tracing started; times in the trace are relative to it
+unsigned long long const start_time = stats::now(); ///< when the program started, for the elapsed time
+
+/// Add the calling thread's counters to the global counters and clear them.
+void fold_totals()
+{
+  boost::mutex::scoped_lock lock(totals_mutex);
+  global_totals += local_totals;
+  std::memset(&local_totals, 0, sizeof(local_totals));
+}
+
+/// Return the calling thread's spans, starting a new list the first time.
+thread_trace& local_spans()
+{
+  if (local_trace == 0)
+  {
+    boost::mutex::scoped_lock lock(traces_mutex);
+    local_trace = new thread_trace(traces.size() + 1);
+    traces.push_back(local_trace);
+  }
+  return *local_trace;
+}
+
+/// Write a string literal.
+template<std::size_t N>
+inline void write_literal(output_buffer& out, char const (&text)[N])
+{
+  out.write(text, N - 1);
+}
+
+/// Write a time in the trace, in microseconds.
+void write_microseconds(output_buffer& out, unsigned long long nanoseconds)
+{
+  unsigned long const fraction = nanoseconds % 1000;
+  out.write_number(nanoseconds / 1000);
+  out.put('.');
+  out.put(static_cast<char>('0' + fraction / 100));
+  out.put(static_cast<char>('0' + fraction / 10 % 10));
+  out.put(static_cast<char>('0' + fraction % 10));
+}
+
+/// Write one complete event, without its arguments or closing brace.
+void write_event(output_buffer& out, std::string const& name, char const* category, unsigned id,
+                 unsigned long long begin, unsigned long long end)
+{
+  write_literal(out, "{\"name\":");
+  out.write_json(name);
+  write_literal(out, ",\"cat\":\"");
+  out.write(category, std::strlen(category));
+  write_literal(out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+  out.write_number(id);
+  write_literal(out, ",\"ts\":");
+  write_microseconds(out, begin - trace_origin);
+  write_literal(out, ",\"dur\":");
+  write_microseconds(out, end - begin);
+}
+
+/// Return the peak resident set size of the process, in bytes.
+unsigned long long peak_rss()
+{
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return static_cast<unsigned long long>(usage.ru_maxrss) * 1024;
+}
+
+/// Print a time in seconds, with all the digits of the nanoseconds.
+void write_seconds(std::ostream& out, unsigned long long nanoseconds)
+{
+  char const fill = out.fill('0');
+  out << nanoseconds / 1000000000ULL << '.';
+  out.width(9);
+  out << nanoseconds % 1000000000ULL;
+  out.fill(fill);
+}
+
+/// Print a Prometheus metric without labels, with its help and type.
+void write_metric(std::ostream& out, char const* name, char const* type, char const* help,
+                  unsigned long long value)
+{
+  out << "# HELP odfgrep_" << name << ' ' << help << "\n"
+         "# TYPE odfgrep_" << name << ' ' << type << "\n"
+         "odfgrep_" << name << ' ' << value << '\n';
+}
+
+/// Print the report as a table.
+void report_text(std::ostream& out, stats::totals_type const& t, arena::counters const& a)
+{
+  for (int c = 0; c != stats::counter_count; ++c)
+    out << counter_labels[c] << t.counts[c] << '\n';
+  out << "longest paragraph:        " << t.longest_paragraph << " bytes\n";
+  out << "peak resident set:        " << peak_rss() << " bytes\n";
+  out << "elapsed time:             ";
+  write_seconds(out, stats::now() - start_time);
+  out << " s\n";
+  for (int s = 0; s != stats::stage_count; ++s)
+  {
+    std::string label = std::string("time in ") + stage_names[s] + ':';
+    label.resize(26, ' ');
+    out << label;
+    write_seconds(out, t.nanoseconds[s]);
+    out << " s (" << t.calls[s] << " calls)\n";
+  }
+  out << "allocations from arenas:  " << a.allocations << " (" << a.bytes << " bytes)\n"
+         "allocations from malloc:  " << a.heap_allocations << " (" << a.heap_bytes << " bytes)\n"
+         "calls to free:            " << a.frees << '\n' <<
+         "frees skipped by arenas:  " << a.skipped_frees << '\n' <<
+         "arena chunks allocated:   " << a.chunks << '\n' <<
+         "arena resets:             " << a.resets << '\n';
+}
+
+/// Print the report as one JSON object.
+void report_json(std::ostream& out, stats::totals_type const& t, arena::counters const& a)
+{
+  out << '{';
+  for (int c = 0; c != stats::counter_count; ++c)
+    out << '"' << counter_names[c] << "\":" << t.counts[c] << ',';
+  out << "\"longest_paragraph_bytes\":" << t.longest_paragraph << ",\"peak_rss_bytes\":" << peak_rss() << ",\"elapsed_seconds\":";
+  write_seconds(out, stats::now() - start_time);
+  out << ",\"stages\":{";
+  for (int s = 0; s != stats::stage_count; ++s)
+  {
+    out << (s == 0 ? "\"" : ",\"") << stage_names[s] << "\":{\"seconds\":";
+    write_seconds(out, t.nanoseconds[s]);
+    out << ",\"calls\":" << t.calls[s] << '}';
+  }
+  out << "},\"arena\":{"
+         "\"allocations\":" << a.allocations << ",\"bytes\":" << a.bytes <<
+         ",\"heap_allocations\":" << a.heap_allocations << ",\"heap_bytes\":" << a.heap_bytes <<
+         ",\"frees\":" << a.frees << ",\"skipped_frees\":" << a.skipped_frees <<
+         ",\"chunks\":" << a.chunks << ",\"resets\":" << a.resets << "}}\n";
+}
+
+/// Print the report in the Prometheus text format.
+void report_prometheus(std::ostream& out, stats::totals_type const& t, arena::counters const& a)
+{
+  for (int c = 0; c != stats::counter_count; ++c)
+    write_metric(out, (std::string(counter_names[c]) + "_total").c_str(), "counter", counter_help[c], t.counts[c]);
+  write_metric(out, "longest_paragraph_bytes", "gauge", "Bytes in the longest paragraph.", t.longest_paragraph);
+  write_metric(out, "peak_rss_bytes", "gauge", "Peak resident set size.", peak_rss());
+  out << "# HELP odfgrep_elapsed_seconds Time since odfgrep started.\n"
+         "# TYPE odfgrep_elapsed_seconds gauge\n"
+         "odfgrep_elapsed_seconds ";
+  write_seconds(out, stats::now() - start_time);
+  out << '\n';
+  out << "# HELP odfgrep_stage_seconds_total Time spent in each stage, not counting the stages inside it.\n"
+         "# TYPE odfgrep_stage_seconds_total counter\n";
+  for (int s = 0; s != stats::stage_count; ++s)
+  {
+    out << "odfgrep_stage_seconds_total{stage=\"" << stage_names[s] << "\"} ";
+    write_seconds(out, t.nanoseconds[s]);
+    out << '\n';
+  }
+  out << "# HELP odfgrep_stage_calls_total Number of times each stage was entered.\n"
+         "# TYPE odfgrep_stage_calls_total counter\n";
+  for (int s = 0; s != stats::stage_count; ++s)
+    out << "odfgrep_stage_calls_total{stage=\"" << stage_names[s] << "\"} " << t.calls[s] << '\n';
+  write_metric(out, "arena_allocations_total", "counter", "Blocks served from an arena.", a.allocations);
+  write_metric(out, "arena_bytes_total", "counter", "Bytes served from an arena.", a.bytes);
+  write_metric(out, "heap_allocations_total", "counter", "Blocks passed through to malloc by the libxml2 hooks.", a.heap_allocations);
+  write_metric(out, "heap_bytes_total", "counter", "Bytes passed through to malloc by the libxml2 hooks.", a.heap_bytes);
+  write_metric(out, "frees_total", "counter", "Calls to free that reached the C library.", a.frees);
+  write_metric(out, "skipped_frees_total", "counter", "Calls to free for arena memory.", a.skipped_frees);
+  write_metric(out, "arena_chunks_total", "counter", "Chunks obtained from malloc to back the arenas.", a.chunks);
+  write_metric(out, "arena_resets_total", "counter", "Arena resets.", a.resets);
+}
+
+} // end of namespace
+
+bool stats::enabled_ = false;
+bool stats::tracing_ = false;
+
+void stats::enable_trace()
+{
+  trace_origin = now();
+  local_spans();
+  enabled_ = tracing_ = true;
+}
+
+stats::totals_type& stats::totals_type::operator+=(totals_type const& other)
+{
+  for (int c = 0; c != counter_count; ++c)
+    counts[c] += other.counts[c];
+  for (int s = 0; s != stage_count; ++s)
+  {
+    nanoseconds[s] += other.nanoseconds[s];
+    calls[s]       += other.calls[s];
+  }
+  if (other.longest_paragraph > longest_paragraph)
+    longest_paragraph = other.longest_paragraph;
+  return *this;
+}
+
+void stats::add_local(counter c, unsigned long long n)
+{
+  local_totals.counts[c] += n;
+}
+
+void stats::add_paragraph(unsigned long long size)
+{
+  ++local_totals.counts[paragraphs];
+  if (size > local_totals.longest_paragraph)
+    local_totals.longest_paragraph = size;
+}
+
+unsigned long long stats::now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+char const* stats::name(stage s)
+{
+  return stage_names[s];
+}
+
+stats::totals_type const& stats::local()
+{
+  return local_totals;
+}
+
+stats::totals_type stats::take()
+{
+  totals_type const result = local_totals;
+  std::memset(&local_totals, 0, sizeof(local_totals));
+  return result;
+}
+
+void stats::merge(totals_type const& other)
+{
+  local_totals += other;
+}
+
+void stats::fold()
+{
+  if (enabled_)
+    fold_totals();
+}
+
+stats::totals_type stats::totals()
+{
+  fold_totals();
+  boost::mutex::scoped_lock lock(totals_mutex);
+  return global_totals;
+}
+
+void stats::report(std::ostream& out, format how)
+{
+  totals_type const t = totals();
+  arena::counters const a = arena::totals();
+  switch (how)
+  {
+  case text_format:       report_text(out, t, a);       break;
+  case json_format:       report_json(out, t, a);       break;
+  case prometheus_format: report_prometheus(out, t, a); break;
+  }
+}
+
+
+void stats::write_trace(output_buffer& out)
+{
+  boost::mutex::scoped_lock lock(traces_mutex);
+  unsigned long long dropped = 0;
+  write_literal(out, "{\"traceEvents\":[");
+  for (std::vector<thread_trace*>::const_iterator t = traces.begin(); t != traces.end(); ++t)
+  {
+    thread_trace const& trace = **t;
+    if (t != traces.begin())
+      out.put(',');
+    out.put('\n');
+    write_literal(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+    out.write_number(trace.id);
+    write_literal(out, ",\"args\":{\"name\":");
+    if (trace.id == 1)
+      write_literal(out, "\"main\"}}");
+    else
+    {
+      write_literal(out, "\"worker ");
+      out.write_number(trace.id - 1);
+      write_literal(out, "\"}}");
+    }
+    for (std::vector<named_span>::const_iterator d = trace.documents.begin(); d != trace.documents.end(); ++d)
+    {
+      write_literal(out, ",\n");
+      write_event(out, d->name, "document", trace.id, d->begin, d->end);
+      out.put('}');
+    }
+    std::size_t const size = trace.stages.size();
+    for (std::size_t i = 0; i != size; ++i)
+    {
+      stage_span const& span = trace.stages[(trace.next + i) % size];
+      write_literal(out, ",\n");
+      write_event(out, stage_names[span.stage], "stage", trace.id, span.begin, span.end);
+      out.put('}');
+    }
+    dropped += trace.dropped;
+  }
+  write_literal(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_spans\":");
+  out.write_number(dropped);
+  write_literal(out, "}}\n");
+}
+
+
+stats::document_span::document_span(std::string const& name)
+: name_(tracing_ ? &name : 0), begin_(tracing_ ? now() : 0)
+{}
+
+stats::document_span::~document_span()
+{
+  if (name_ == 0)
+    return;
+  named_span span;
+  span.begin = begin_;
+  span.end = now();
+  span.name = *name_;
+  local_spans().documents.push_back(span);
+}
+
+
+void stats::timer::start(stage s)
+{
+  unsigned long long const t = now();
+  begin_ = t;
+  if (current_stage >= 0)
+    local_totals.nanoseconds[current_stage] += t - stage_start;
+  previous_ = current_stage;
+  current_stage = s;
+  stage_start = t;
+  ++local_totals.calls[s];
+}
+
+void stats::timer::stop()
+{
+  unsigned long long const t = now();
+  local_totals.nanoseconds[current_stage] += t - stage_start;
+  if (tracing_)
+  {
+    stage_span const span = { begin_, t, static_cast<stage>(current_stage) };
+    thread_trace& spans = local_spans();
+    if (spans.stages.size() < trace_capacity)
+      spans.stages.push_back(span);
+    else
+    {
+      spans.stages[spans.next] = span;
+      spans.next = (spans.next + 1) % trace_capacity;
+      ++spans.dropped;
+    }
+  }
+  current_stage = previous_;
+  stage_start = t;
+}
@@ -0,0 +1,193 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file stats.hpp
+ * Counters and stage timers for --stats, and the span recorder for --trace.
+ * Each thread counts and times in variables of its own, which are folded
+ * into the totals at the end of each document, so the counters cost no
+ * locking. Each thread also records its spans in a buffer of its own.
+ * When neither option is given, a counter or timer costs one test
+ * of a flag.
+ */
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <iosfwd>
+#include <string>
+
+class output_buffer;
+
+/** Statistics about the whole run, for --stats.
+ * The stages are timed exclusively: while a stage runs inside another,
+ * such as the regex inside the extraction, the time counts for the inner
+ * stage only, so the stage times add up to the time spent searching.
+ */
+class stats
+{
+public:
+  /// The stages of searching a document, which are timed separately.
+  enum stage {
+    open_stage,    ///< opening a package or mapping a flat document
+    inflate_stage, ///< inflating a stream of a package
+    parse_stage,   ///< parsing a stream into a libxml2 tree
+    extract_stage, ///< finding the paragraphs, including the parse for the reader and the scanner
+    convert_stage, ///< converting paragraphs from UTF-8 to UTF-32
+    match_stage,   ///< running the regex
+    output_stage,  ///< performing the action and writing the output
+    stage_count
+  };
+  /// The quantities that are counted.
+  enum counter {
+    documents,        ///< documents searched
+    compressed_bytes, ///< bytes of package streams before they were inflated
+    inflated_bytes,   ///< bytes of package streams after they were inflated
+    flat_bytes,       ///< bytes of flat documents
+    paragraphs,       ///< paragraphs extracted
+    matches,          ///< matches reported
+    counter_count
+  };
+  /// How to print the report.
+  enum format {
+    text_format,      ///< a table for people to read
+    json_format,      ///< one JSON object
+    prometheus_format ///< the Prometheus text format, for the node exporter's textfile collector
+  };
+
+  /// The counters and times, summed over all threads.
+  struct totals_type
+  {
+    unsigned long long counts[counter_count];      ///< the value of each counter
+    unsigned long long nanoseconds[stage_count];   ///< the time spent in each stage
+    unsigned long long calls[stage_count];         ///< the number of times each stage was entered
+    unsigned long long longest_paragraph;          ///< the number of bytes in the longest paragraph
+
+    /// Add the counters and times of @p other, and keep the longer of the longest paragraphs.
+    totals_type& operator+=(totals_type const& other);
+  };
+
+  /// Start counting. Until this is called, counters and timers do nothing.
+  static void enable() { enabled_ = true; }
+  /// Start counting, and record a span for each timer and each document.
+  /// The calling thread is named "main" in the trace.
+  static void enable_trace();
+  /// Test whether --stats or --trace asked for statistics.
+  static bool enabled() { return enabled_; }
+  /// Add to one of the calling thread's counters.
+  /// @param c the counter
+  /// @param n the amount to add
+  static void add(counter c, unsigned long long n = 1)
+  {
+    if (enabled_)
+      add_local(c, n);
+  }
+  /// Count a paragraph that was extracted.
+  /// @param size the number of bytes in the paragraph
+  static void paragraph(unsigned long long size)
+  {
+    if (enabled_)
+      add_paragraph(size);
+  }
+  /// Return the time from a monotonic clock, in nanoseconds.
+  static unsigned long long now();
+  /// Return the name of a stage, such as "inflate".
+  static char const* name(stage s);
+  /// Return the calling thread's counters and times since they were last
+  /// folded or taken. A thread that folds after each document gets the
+  /// statistics of its current document.
+  static totals_type const& local();
+  /// Take the calling thread's counters and times instead of folding them,
+  /// to merge() them into another thread's.
+  static totals_type take();
+  /// Add counters and times that another thread took to the calling thread's.
+  static void merge(totals_type const& other);
+  /// Fold the calling thread's counters and times into the totals.
+  static void fold();
+  /// Return the totals. The calling thread's counters are folded in first.
+  static totals_type totals();
+  /** Print the report.
+   * The allocation counters of the arenas are included if the libxml2
+   * memory hooks are installed.
+   * @param out where to print
+   * @param how the format
+   */
+  static void report(std::ostream& out, format how);
+  /** Write the spans that were recorded, in the Chrome Trace Event format,
+   * which Perfetto and chrome://tracing read.
+   * Each thread keeps the most recent spans of the stages, up to a limit,
+   * and the span of every document. The number of spans that were dropped
+   * is given in the trace's metadata.
+   * Call this after the other threads have stopped.
+   * @param out where to write
+   */
+  static void write_trace(output_buffer& out);
+
+  /// Time a stage, from construction to destruction. While the timer
+  /// lives, the stage that was running on the thread is paused.
+  class timer
+  {
+  public:
+    /// Start timing.
+    /// @param s the stage
+    explicit timer(stage s) : active_(enabled_)
+    {
+      if (active_)
+        start(s);
+    }
+    /// Stop timing, and resume the stage that was paused.
+    ~timer()
+    {
+      if (active_)
+        stop();
+    }
+  private:
+    timer(timer const&);          ///< not implemented
+    void operator=(timer const&); ///< not implemented
+    void start(stage s);          ///< charge the paused stage and start @p s
+    void stop();                  ///< charge this stage and resume the paused one
+    bool active_;                 ///< true if --stats or --trace was given when the timer started
+    int previous_;                ///< the stage that was paused, or -1
+    unsigned long long begin_;    ///< when the timer started, for the trace
+  };
+
+  /// Record a span for a document in the trace, from construction to destruction.
+  class document_span
+  {
+  public:
+    /// Start the span.
+    /// @param name the document's name
+    explicit document_span(std::string const& name);
+    /// End the span.
+    ~document_span();
+  private:
+    document_span(document_span const&);  ///< not implemented
+    void operator=(document_span const&); ///< not implemented
+    std::string const* name_;     ///< the document's name, or null if --trace was not given
+    unsigned long long begin_;    ///< when the span started
+  };
+
+private:
+  static void add_local(counter c, unsigned long long n);
+  static void add_paragraph(unsigned long long size);
+  static bool enabled_; ///< true if --stats or --trace was given
+  static bool tracing_; ///< true if --trace was given
+};
+
+#endif
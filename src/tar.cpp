@@ -0,0 +1,210 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/// @file tar.cpp
+/// Implement the tar_reader class.
+
+#include "tar.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+
+/// Tar archives are made of blocks of this size.
+std::size_t const block_size = 512;
+
+/// Fields of a ustar header: offset and length.
+enum {
+  name_offset = 0, name_length = 100,
+  size_offset = 124, size_length = 12,
+  mtime_offset = 136, mtime_length = 12,
+  checksum_offset = 148, checksum_length = 8,
+  type_offset = 156,
+  magic_offset = 257,
+  prefix_offset = 345, prefix_length = 155
+};
+
+/// Read a numeric field, which is octal, or base-256 if the high bit of
+/// the first byte is set, as GNU tar writes sizes of 8 GB and more.
+/// @param field the start of the field
+/// @param length the number of bytes in the field
+/// @returns the value of the field
+unsigned long long number(char const* field, std::size_t length)
+{
+  unsigned long long result = 0;
+  if (static_cast<unsigned char>(field[0]) & 0x80)
+  {
+    result = static_cast<unsigned char>(field[0]) & 0x7f;
+    for (std::size_t i = 1; i != length; ++i)
+      result = result << 8 | static_cast<unsigned char>(field[i]);
+    return result;
+  }
+  std::size_t i = 0;
+  while (i != length and field[i] == ' ')
+    ++i;
+  for (; i != length and field[i] >= '0' and field[i] <= '7'; ++i)
+    result = result * 8 + (field[i] - '0');
+  return result;
+}
+
+/// Read a NUL-terminated string field, which can fill the field without a NUL.
+std::string text(char const* field, std::size_t length)
+{
+  return std::string(field, std::find(field, field + length, '\0'));
+}
+
+/// Check the header checksum, which is the sum of the header's bytes
+/// with the checksum field itself counted as spaces.
+bool valid_checksum(char const* header)
+{
+  unsigned long sum = 0;
+  for (std::size_t i = 0; i != block_size; ++i)
+    if (i >= checksum_offset and i < checksum_offset + checksum_length)
+      sum += ' ';
+    else
+      sum += static_cast<unsigned char>(header[i]);
+  return sum == number(header + checksum_offset, checksum_length);
+}
+
+} // end of namespace
+
+bool tar_reader::is_tar(char const* data, std::size_t size)
+{
+  return size >= block_size and std::memcmp(data + magic_offset, "ustar", 5) == 0 and valid_checksum(data);
+}
+
+tar_reader::tar_reader(std::istream& in, std::string const& name)
+: in_(in), name_(name), size_(0), mtime_(0), left_(0), padding_(0)
+{}
+
+void tar_reader::skip(std::size_t size)
+{
+  while (size != 0)
+  {
+    char buffer[8192];
+    std::size_t const n = std::min(size, sizeof(buffer));
+    if (not in_.read(buffer, n))
+      throw error(name_, "unexpected end of archive");
+    size -= n;
+  }
+}
+
+std::string tar_reader::read_extension(std::size_t size)
+{
+  std::string result(size, '\0');
+  if (size != 0 and not in_.read(&result[0], size))
+    throw error(name_, "unexpected end of archive");
+  skip((block_size - size % block_size) % block_size);
+  return result;
+}
+
+bool tar_reader::next()
+{
+  skip(left_ + padding_);
+  left_ = padding_ = 0;
+
+  std::string long_path;          // from a GNU long name or a pax header
+  unsigned long long pax_size = 0; // from a pax header, or 0
+  bool have_pax_size = false;
+  for (;;)
+  {
+    char header[block_size];
+    if (not in_.read(header, block_size))
+    {
+      if (in_.gcount() == 0)
+        return false; // some writers omit the end-of-archive blocks
+      throw error(name_, "unexpected end of archive");
+    }
+    if (header[0] == '\0' and std::count(header, header + block_size, '\0') == static_cast<std::ptrdiff_t>(block_size))
+      return false;
+    if (not valid_checksum(header))
+      throw error(name_, "bad header checksum");
+
+    unsigned long long size = number(header + size_offset, size_length);
+    char const type = header[type_offset];
+    if (type == 'L')
+    {
+      long_path = read_extension(size);
+      long_path.erase(std::find(long_path.begin(), long_path.end(), '\0'), long_path.end());
+    }
+    else if (type == 'x')
+    {
+      // Records have the form "length key=value\n".
+      std::string const records = read_extension(size);
+      std::string::size_type pos = 0;
+      while (pos < records.size())
+      {
+        char* end;
+        unsigned long const length = std::strtoul(records.c_str() + pos, &end, 10);
+        std::string::size_type const space = end - records.c_str();
+        std::string::size_type const equal = records.find('=', space);
+        if (length == 0 or pos + length > records.size() or equal == std::string::npos or equal > pos + length)
+          break;
+        std::string const key = records.substr(space + 1, equal - space - 1);
+        std::string const value = records.substr(equal + 1, pos + length - equal - 2);
+        if (key == "path")
+          long_path = value;
+        else if (key == "size")
+        {
+          pax_size = std::strtoull(value.c_str(), 0, 10);
+          have_pax_size = true;
+        }
+        pos += length;
+      }
+    }
+    else if (type == '0' or type == '\0' or type == '7')
+    {
+      if (not long_path.empty())
+        path_ = long_path;
+      else
+      {
+        std::string const prefix = text(header + prefix_offset, prefix_length);
+        path_ = text(header + name_offset, name_length);
+        if (not prefix.empty())
+          path_ = prefix + '/' + path_;
+      }
+      if (have_pax_size)
+        size = pax_size;
+      size_ = left_ = static_cast<std::size_t>(size);
+      padding_ = (block_size - size_ % block_size) % block_size;
+      mtime_ = static_cast<std::time_t>(number(header + mtime_offset, mtime_length));
+      return true;
+    }
+    else
+    {
+      // A directory, link, global pax header, or other entry without contents to search.
+      skip(static_cast<std::size_t>(size) + (block_size - size % block_size) % block_size);
+      long_path.clear();
+      have_pax_size = false;
+    }
+  }
+}
+
+std::size_t tar_reader::read(char* buffer, std::size_t size)
+{
+  size = std::min(size, left_);
+  if (size != 0 and not in_.read(buffer, size))
+    throw error(name_, "unexpected end of archive");
+  left_ -= size;
+  return size;
+}
@@ -0,0 +1,104 @@
+/***************************************************************************
+ *   Copyright (C) 2006 by Ray Lischner                                    *
+ *   odf@tempest-sw.com                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/** @file tar.hpp
+ * Sequential reading of tar archives, so the documents in a bundle
+ * can be searched as the archive streams past, without extracting
+ * them and without seeking.
+ */
+
+#ifndef TAR_HPP
+#define TAR_HPP
+
+#include <cstddef>
+#include <ctime>
+#include <istream>
+#include <stdexcept>
+#include <string>
+
+/** Read the regular files of a tar archive, one after another.
+ * POSIX ustar and the GNU and pax extensions for long names and large
+ * sizes are understood. Directories, links, and other entries are skipped.
+ * The archive is read strictly in order, so it can come from a pipe.
+ */
+class tar_reader
+{
+public:
+  /// Exception for an archive that is truncated or corrupt.
+  class error : public std::runtime_error
+  {
+  public:
+    /// Construct an exception object.
+    /// @param name the archive name, which prefixes the message
+    /// @param msg the error message
+    error(std::string const& name, std::string const& msg)
+    : std::runtime_error(name + ": " + msg)
+    {}
+  };
+
+  /// Test whether a file is a tar archive, by looking at its first block.
+  /// @param data the start of the file
+  /// @param size the number of bytes in @p data
+  /// @returns true if @p data starts with a ustar header
+  static bool is_tar(char const* data, std::size_t size);
+
+  /// Prepare to read an archive.
+  /// @param in the archive, positioned at its first header
+  /// @param name the archive name, for error messages
+  tar_reader(std::istream& in, std::string const& name);
+
+  /// Move to the next regular file, skipping whatever is left of the current one.
+  /// @returns false at the end of the archive
+  /// @throw error if the archive is truncated or corrupt
+  bool next();
+
+  /// @returns the path of the current file in the archive
+  std::string const& path() const { return path_; }
+  /// @returns the number of bytes in the current file
+  std::size_t size() const { return size_; }
+  /// @returns the modification time of the current file
+  std::time_t mtime() const { return mtime_; }
+
+  /// Read from the current file.
+  /// @param buffer receives the contents
+  /// @param size the number of bytes to read
+  /// @returns the number of bytes read, which is less than @p size only at the end of the file
+  /// @throw error if the archive is truncated
+  std::size_t read(char* buffer, std::size_t size);
+
+private:
+  tar_reader(tar_reader&);        ///< not implemented
+  void operator=(tar_reader&);    ///< not implemented
+
+  /// Skip bytes of the archive.
+  void skip(std::size_t size);
+  /// Read the data of an extension header, such as a GNU long name.
+  std::string read_extension(std::size_t size);
+
+  std::istream& in_;   ///< the archive
+  std::string name_;   ///< the archive name
+  std::string path_;   ///< the path of the current file
+  std::size_t size_;   ///< the size of the current file
+  std::time_t mtime_;  ///< the modification time of the current file
+  std::size_t left_;   ///< bytes of the current file not yet read
+  std::size_t padding_; ///< bytes after the current file that fill out its last block
+};
+
+#endif
@@ -23,8 +23,9 @@
 #include <cwchar>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
-/** Convert a UTF-8 string to UTF-32.
+/** Convert a UTF-8 string to UTF-32 in a caller-supplied buffer.
  * Only basic checking is performed. This function does not
  * detect all erroneous UTF-8 strings, only those that are
  * obvious or interfere with the logic of the conversion function.
@@ -32,20 +33,24 @@
  * Note that I tried a table-lookup version of this function,
  * but it was slower (on an Athlon XP 3000+ running Suse Linux 10.0).
  *
+ * A UTF-8 string never has more code points than bytes, so @p outbuf
+ * needs room for at most @p size wide characters.
+ *
  * @param inbuf pointer to the UTF-8 byte sequence
  * @param size the number of bytes in @p inbuf
- * @return the UTF-32 string
+ * @param outbuf where to store the UTF-32 code points
+ * @return the number of code points stored in @p outbuf
  * @pre wide execution character set is UTF-32
  * @throws std::runtime_error for an invalid UTF-8 string
  */
-std::wstring utf8_to_utf32(unsigned char const* inbuf, std::size_t size)
+std::size_t utf8_to_utf32(unsigned char const* inbuf, std::size_t size, wchar_t* outbuf)
 {
-  std::wstring result;
+  wchar_t* result = outbuf;
 
   for (unsigned char const *p = inbuf; size != 0; ++p, --size)
   {
     if ((*p & 0x80) == 0)
-      result += *p;
+      *result++ = *p;
     else if ((*p & 0xc0) == 0x80)
       throw std::runtime_error(std::string("invalid utf-8 encoding"));
     else
@@ -97,9 +102,85 @@ std::wstring utf8_to_utf32(unsigned char const* inbuf, std::size_t size)
           throw std::runtime_error(std::string("invalid utf-8 encoding"));
         code |= *p & 0x3f;
       }
-      result += static_cast<wchar_t>(code);
+      *result++ = static_cast<wchar_t>(code);
     }
   }
 
+  return result - outbuf;
+}
+
+/** Convert a UTF-8 string to UTF-32.
+ * @param inbuf pointer to the UTF-8 byte sequence
+ * @param size the number of bytes in @p inbuf
+ * @return the UTF-32 string
+ * @pre wide execution character set is UTF-32
+ * @throws std::runtime_error for an invalid UTF-8 string
+ */
+std::wstring utf8_to_utf32(unsigned char const* inbuf, std::size_t size)
+{
+  std::wstring result(size, L'\0');
+  if (size != 0)
+    result.resize(utf8_to_utf32(inbuf, size, &result[0]));
+  return result;
+}
+
+/** Convert a UTF-32 string to UTF-8.
+ * @param inbuf the UTF-32 string
+ * @return the UTF-8 string
+ * @pre wide execution character set is UTF-32
+ */
+std::string utf32_to_utf8(std::wstring const& inbuf)
+{
+  std::string result;
+  result.reserve(inbuf.size());
+  for (std::wstring::const_iterator c = inbuf.begin(); c != inbuf.end(); ++c)
+  {
+    unsigned long const code = static_cast<unsigned long>(*c);
+    if (code < 0x80)
+      result += static_cast<char>(code);
+    else if (code < 0x800)
+    {
+      result += static_cast<char>(0xc0 | (code >> 6));
+      result += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+      result += static_cast<char>(0xe0 | (code >> 12));
+      result += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      result += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    else
+    {
+      result += static_cast<char>(0xf0 | (code >> 18));
+      result += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+      result += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      result += static_cast<char>(0x80 | (code & 0x3f));
+    }
+  }
   return result;
 }
+
+/** Convert code point offsets in a UTF-8 string to byte offsets.
+ * The regex engine reports positions in the UTF-32 copy of a paragraph,
+ * but the paragraph is printed in UTF-8, so positions that are printed
+ * must be converted. Each code point starts with a byte that is not a
+ * continuation byte, so the string is walked once, however many offsets
+ * there are.
+ * @param inbuf pointer to the UTF-8 byte sequence
+ * @param size the number of bytes in @p inbuf
+ * @param offsets code point offsets, in ascending order, which are
+ * replaced by the byte offsets of the same code points
+ */
+void utf32_to_utf8_offsets(char const* inbuf, std::size_t size, std::vector<std::size_t>& offsets)
+{
+  std::size_t byte = 0;  // the byte offset of code point number @c code
+  std::size_t code = 0;
+  for (std::vector<std::size_t>::iterator o = offsets.begin(); o != offsets.end(); ++o)
+  {
+    for (; code != *o and byte != size; ++code)
+      do
+        ++byte;
+      while (byte != size and (static_cast<unsigned char>(inbuf[byte]) & 0xc0) == 0x80);
+    *o = byte;
+  }
+}
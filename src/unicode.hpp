@@ -18,14 +18,32 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#ifndef UNICODE_HPP
+#define UNICODE_HPP
+
 #include <cwchar>
 #include <string>
+#include <vector>
 
 /// @file
 /// Unicode functions.
 
-// Doxygen comment in unicode.cpp.
+// Doxygen comments in unicode.cpp.
+std::size_t utf8_to_utf32(unsigned char const* inbuf, std::size_t size, wchar_t* outbuf);
 std::wstring utf8_to_utf32(unsigned char const* inbuf, std::size_t size);
+void utf32_to_utf8_offsets(char const* inbuf, std::size_t size, std::vector<std::size_t>& offsets);
+std::string utf32_to_utf8(std::wstring const& inbuf);
+
+/// Convert UTF-8 to UTF-32 in a caller-supplied buffer.
+/// @pre wchar_t must be able to hold a UTF-32 code point.
+/// @param inbuf pointer to the UTF-8 character array
+/// @param size number of bytes in @p inbuf
+/// @param outbuf room for at least @p size wide characters
+/// @returns the number of wide characters stored in @p outbuf
+inline std::size_t utf8_to_utf32(char const* inbuf, std::size_t size, wchar_t* outbuf)
+{
+  return utf8_to_utf32(reinterpret_cast<unsigned char const*>(inbuf), size, outbuf);
+}
 
 /// Convert UTF-8 to UTF-32.
 /// @pre wchar_t must be able to hold a UTF-32 code point.
@@ -46,3 +64,5 @@ inline std::wstring utf8_to_utf32(std::string const& inbuf)
 {
   return utf8_to_utf32(inbuf.c_str(), inbuf.size());
 }
+
+#endif
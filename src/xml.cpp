@@ -22,6 +22,8 @@
 /// Implement the XML wrapper classes.
 
 #include "xml.hpp"
+#include "arena.hpp"
+#include <algorithm>
 #include <climits>
 
 extern "C"
@@ -29,6 +31,7 @@ extern "C"
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/relaxng.h>
+#include <libxml/xmlreader.h>
 }
 
 namespace xml
@@ -55,7 +58,7 @@ namespace xml
   }
 
   doc::doc()
-  : doc_(0)
+  : doc_(0), in_arena_(false)
   {}
 
   doc::~doc()
@@ -65,8 +68,9 @@ namespace xml
 
   void doc::close()
   {
-    if (doc_ != 0)
+    if (doc_ != 0 and not in_arena_)
       xmlFreeDoc(doc_);
+    doc_ = 0;
   }
 
   xmlNode* doc::get_root_element()
@@ -85,9 +89,27 @@ namespace xml
     return parse(buffer.c_str());
   }
 
+  bool doc::parse(char const* buffer, std::size_t size)
+  {
+    close();
+    if (size > INT_MAX)
+      return false;
+    in_arena_ = arena::current() != 0;
+    doc_ = xmlReadMemory(buffer, static_cast<int>(size), 0, 0, 0);
+    return doc_ != 0;
+  }
+
+  xmlChar const* doc::intern(char const* str)
+  {
+    if (doc_ == 0 or doc_->dict == 0)
+      return 0;
+    return xmlDictLookup(doc_->dict, ucharptr(str), -1);
+  }
+
   bool doc::parse(unsigned char const* buffer)
   {
     close();
+    in_arena_ = arena::current() != 0;
     doc_ = xmlParseDoc(buffer);
     return doc_ != 0;
   }
@@ -95,6 +117,7 @@ namespace xml
   bool doc::parse_entity(char const* filename)
   {
     close();
+    in_arena_ = arena::current() != 0;
     doc_ = xmlParseEntity(filename);
     return doc_ != 0;
   }
@@ -125,6 +148,56 @@ namespace xml
       }
   }
 
+  reader::reader(char const* buffer, std::size_t size, char const* url, int options)
+  : reader_(0), next_(buffer), end_(buffer + size)
+  {
+    if (size <= INT_MAX)
+      reader_ = xmlReaderForMemory(buffer, static_cast<int>(size), url, 0, options);
+    else
+      reader_ = xmlReaderForIO(read_callback, 0, this, url, 0, options);
+  }
+  int reader::read_callback(void* context, char* buffer, int len)
+  {
+    reader* self = static_cast<reader*>(context);
+    std::size_t const size = std::min(static_cast<std::size_t>(len), static_cast<std::size_t>(self->end_ - self->next_));
+    std::memcpy(buffer, self->next_, size);
+    self->next_ += size;
+    return static_cast<int>(size);
+  }
+  reader::~reader()
+  {
+    if (reader_ != 0)
+      xmlFreeTextReader(reader_);
+  }
+
+  int reader::read()
+  {
+    return xmlTextReaderRead(reader_);
+  }
+  int reader::next()
+  {
+    return xmlTextReaderNext(reader_);
+  }
+  bool reader::attribute(char const* local_name, char const* uri, std::string& value)
+  const
+  {
+    xmlChar* text = xmlTextReaderGetAttributeNs(reader_, ucharptr(local_name), ucharptr(uri));
+    if (text == 0)
+      return false;
+    try {
+      value = string(text);
+      xmlFree(text);
+      return true;
+    } catch(...) {
+      xmlFree(text);
+      throw;
+    }
+  }
+  xmlChar const* reader::intern(char const* str)
+  {
+    return xmlTextReaderConstString(reader_, ucharptr(str));
+  }
+
   rng_parser_context::rng_parser_context() : context_(0) {}
   rng_parser_context::rng_parser_context(char const* schema_file) : context_(0)
   {
@@ -36,6 +36,7 @@ extern "C"
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/relaxng.h>
+#include <libxml/xmlreader.h>
 }
 
 /// All the XML code resides in this namespace.
@@ -225,6 +226,75 @@ namespace xml
     xmlSAXHandler callbacks_;
   };
 
+  /// Wrapper class for libxml2's pull parser, xmlTextReader.
+  /// The reader visits one node at a time in document order and
+  /// keeps only the current node in memory. Call next() instead of read()
+  /// to skip a whole subtree without visiting it.
+  class reader
+  {
+  public:
+    /// Node types returned by type().
+    enum node_type {
+      element = XML_READER_TYPE_ELEMENT,
+      text = XML_READER_TYPE_TEXT,
+      cdata = XML_READER_TYPE_CDATA,
+      whitespace = XML_READER_TYPE_WHITESPACE,
+      significant_whitespace = XML_READER_TYPE_SIGNIFICANT_WHITESPACE,
+      end_element = XML_READER_TYPE_END_ELEMENT
+    };
+
+    /// Construct a reader for an in-memory XML document.
+    /// The document can be larger than libxml2's in-memory limit of INT_MAX bytes.
+    /// @param buffer a pointer to the in-memory XML document, which must outlive the reader
+    /// @param size the number of bytes that @p buffer points to
+    /// @param url the document name, for error messages
+    /// @param options libxml2 parser options (XML_PARSE_*)
+    reader(char const* buffer, std::size_t size, char const* url, int options = 0);
+    /// Destroy the reader.
+    ~reader();
+
+    /// Move to the next node in document order.
+    /// @returns 1 for success, 0 at the end of the document, or -1 for an error
+    int read();
+    /// Skip the children of the current node and move to its next sibling.
+    /// @returns 1 for success, 0 at the end of the document, or -1 for an error
+    int next();
+
+    /// @returns the type of the current node, e.g., @c element
+    int type() const { return xmlTextReaderNodeType(reader_); }
+    /// @returns the depth of the current node; the root element is at depth 0
+    int depth() const { return xmlTextReaderDepth(reader_); }
+    /// @returns true if the current node is an empty element, such as \<p/\>
+    bool is_empty_element() const { return xmlTextReaderIsEmptyElement(reader_) == 1; }
+    /// @returns the local name of the current node, interned in the reader's dictionary
+    xmlChar const* local_name() const { return xmlTextReaderConstLocalName(reader_); }
+    /// @returns the namespace URI of the current node, interned in the reader's dictionary, or null
+    xmlChar const* namespace_uri() const { return xmlTextReaderConstNamespaceUri(reader_); }
+    /// @returns the text of the current text node; valid until the reader moves
+    xmlChar const* value() const { return xmlTextReaderConstValue(reader_); }
+    /// Get an attribute of the current element.
+    /// @param local_name the attribute's local name
+    /// @param uri the attribute's namespace URI
+    /// @param[out] value the attribute's value, if it is present
+    /// @returns true if the attribute is present
+    bool attribute(char const* local_name, char const* uri, std::string& value) const;
+    /// Intern a string in the reader's dictionary, which holds the names that local_name() returns.
+    /// @returns the interned string, which lives as long as the reader
+    xmlChar const* intern(char const* str);
+
+    /// Indicate whether the reader was created.
+    /// @returns 0 if the reader could not be created, non-0 if it is okay
+    operator void*() const { return reader_; }
+  private:
+    reader(reader&);              ///< do not implement
+    void operator=(reader&);      ///< do not implement
+    /// Input callback for a document that is too large for xmlReaderForMemory.
+    static int read_callback(void* context, char* buffer, int len);
+    xmlTextReader* reader_;       ///< the libxml2 reader
+    char const* next_;            ///< the next byte that read_callback will pass to libxml2
+    char const* end_;             ///< the end of the document
+  };
+
   /// Wrapper class for libxml2 XML document.
   class doc
   {
@@ -239,6 +309,8 @@ namespace xml
     _xmlNode* get_root_element() const;
 
     /// Close the document and release memory.
+    /// A document that was parsed while an arena was current is not freed
+    /// node by node; its memory is released when the arena is reset.
     void close();
 
     /// Parse an in-memory XML document.
@@ -253,6 +325,16 @@ namespace xml
     /// @param buffer a pointer to an in-memory XML document. The string contains UTF-8 characters.
     /// @returns true for success or false if the XML cannot be parsed
     bool parse(std::string const& buffer);
+    /// Parse an in-memory XML document.
+    /// Element names are interned in the document's dictionary, see intern().
+    /// @param buffer a pointer to an in-memory XML document, which need not be NUL-terminated
+    /// @param size the number of bytes that @p buffer points to
+    /// @returns true for success or false if the XML cannot be parsed
+    bool parse(char const* buffer, std::size_t size);
+
+    /// Intern a string in the document's dictionary, which holds its element names.
+    /// @returns the interned string, or null if the document has no dictionary
+    xmlChar const* intern(char const* str);
 
     /// Parse an XML document in an external file.
     /// @param filename the path to the file that contains the XML document
@@ -276,6 +358,7 @@ namespace xml
     doc(doc&);                ///< do not implement
     void operator=(doc&);     ///< do not implement
     xmlDoc* doc_;             ///< the libxml2 document pointer
+    bool in_arena_;           ///< true if @\c doc_ was allocated from an arena
   };
 
   /** Convert @c xmlChar pointer to @c char pointer.
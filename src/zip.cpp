@@ -138,6 +138,12 @@ Archive::Archive(std::string const& filename, Flags flags)
   open(filename.c_str(), flags);
 }
 
+Archive::Archive(void const* data, std::size_t size, std::string const& name)
+  : filename_(name), zip_(0)
+{
+  open(data, size, name);
+}
+
 Archive::~Archive()
 {
   close();
@@ -154,6 +160,29 @@ void Archive::open(char const* filename, Flags flags)
   filename_ = filename;
 }
 
+void Archive::open(void const* data, std::size_t size, std::string const& name)
+{
+  close();
+
+  zip_error_t error;
+  zip_error_init(&error);
+  zip_source_t* source = zip_source_buffer_create(data, size, 0, &error);
+  if (source != 0)
+  {
+    zip_ = zip_open_from_source(source, ZIP_RDONLY, &error);
+    if (zip_ == 0)
+      zip_source_free(source);
+  }
+  if (zip_ == 0)
+  {
+    std::string const msg = zip_error_strerror(&error);
+    zip_error_fini(&error);
+    throw Exception(name, msg);
+  }
+  zip_error_fini(&error);
+  filename_ = name;
+}
+
 void Archive::close()
 {
   if (zip_ != 0 and zip_close(zip_) != 0)
@@ -176,17 +205,46 @@ const
 }
 
 
+std::time_t Archive::mtime(char const* name)
+const
+{
+  struct zip_stat status;
+  zip_stat_init(&status);
+  if (zip_stat(zip_, name, 0, &status) != 0 or (status.valid & ZIP_STAT_MTIME) == 0)
+    return -1;
+  return status.mtime;
+}
+
+zip_uint64_t Archive::compressed_size(char const* name)
+const
+{
+  struct zip_stat status;
+  zip_stat_init(&status);
+  if (zip_stat(zip_, name, 0, &status) != 0 or (status.valid & ZIP_STAT_COMP_SIZE) == 0)
+    return 0;
+  return status.comp_size;
+}
+
+
 void Archive::copy(Archive& source, int index)
 {
   Source src(*this, source, index);
-  if (zip_add(zip_, zip_get_name(source.zip_, index, 0), src.source()) != 0)
+  if (zip_add(zip_, zip_get_name(source.zip_, index, 0), src.source()) < 0)
     throw Exception(filename_, *this);
 }
 
 void Archive::add(std::string const& name, std::string const& source)
 {
   Source src(*this, source);
-  if (zip_add(zip_, name.c_str(), src.source()) != 0)
+  if (zip_add(zip_, name.c_str(), src.source()) < 0)
+    throw Exception(filename_, *this);
+}
+
+void Archive::add_stored(std::string const& name, std::string const& source)
+{
+  Source src(*this, source);
+  zip_int64_t const index = zip_add(zip_, name.c_str(), src.source());
+  if (index < 0 or zip_set_file_compression(zip_, index, ZIP_CM_STORE, 0) != 0)
     throw Exception(filename_, *this);
 }
 
@@ -28,6 +28,7 @@
 */
 
 #include <cstdlib>
+#include <ctime>
 #include <string>
 #include <stdexcept>
 #include <vector>
@@ -120,6 +121,12 @@ class Archive
     /// @param filename path to the zip archive file
     /// @param flags flags for opening the file
     Archive(char const* filename, Flags flags = noflags);
+    /// Construct the archive object from a ZIP file in memory,
+    /// such as a document inside a bundle.
+    /// @param data the ZIP file, which must outlive the archive
+    /// @param size the number of bytes in @p data
+    /// @param name the name to use in error messages
+    Archive(void const* data, std::size_t size, std::string const& name);
     /// Default constructor. Does not open any file.
     Archive() : zip_(0), filename_("") {}
     /// Destructor automatically closes the archive.
@@ -130,6 +137,12 @@ class Archive
     /// @param flags flags for opening the file
     /// @throw Exception if the file cannot be opened
     void open(char const* filename, Flags flags = noflags);
+    /// Opens a ZIP file in memory, read-only. Closes the old archive if there was one open.
+    /// @param data the ZIP file, which must outlive the archive
+    /// @param size the number of bytes in @p data
+    /// @param name the name to use in error messages
+    /// @throw Exception if @p data is not a ZIP file
+    void open(void const* data, std::size_t size, std::string const& name);
     /// Closes the archive if open.
     /// @returns true for success or already closed; false for failure
     /// @throw Exception for any error when closing the file
@@ -146,11 +159,28 @@ class Archive
     /// Return the number of files in the archive.
     int get_num_files() const { return zip_get_num_files(zip_); }
     std::string get_file(int n, FileFlags flags = unchanged) const;
+    /// Find a file in the archive.
+    /// @param name the name of the file
+    /// @returns the index (0-based) of the file, or -1 if the archive does not contain it
+    int locate(char const* name) const { return static_cast<int>(zip_name_locate(zip_, name, 0)); }
+    /// Get the modification time of a file from the central directory.
+    /// @param name the name of the file
+    /// @returns the time, or -1 if the archive does not contain the file
+    std::time_t mtime(char const* name) const;
+    /// Get the compressed size of a file from the central directory.
+    /// @param name the name of the file
+    /// @returns the number of bytes, or 0 if the archive does not contain the file
+    zip_uint64_t compressed_size(char const* name) const;
 
     /// Add a file to the archive.
     /// @param name the name of the file to add
     /// @param source the contents of the file to add
     void add(std::string const& name, std::string const& source);
+    /// Add a file to the archive, stored without compression,
+    /// as ODF requires for the mimetype file.
+    /// @param name the name of the file to add
+    /// @param source the contents of the file to add
+    void add_stored(std::string const& name, std::string const& source);
     /// Copy a file from another archive
     /// @param src the source archive, from which to copy
     /// @param index the index (0-based) of the file to copy from @p src
@@ -238,6 +268,9 @@ public:
   /// @returns a string that contains the entire contents of the file
   /// @throw Exception for read errors
   std::string read();
+  /// Get the compressed size of the file from the central directory.
+  /// @returns the number of bytes
+  zip_uint64_t compressed_size() const { return archive_.compressed_size(filename_.c_str()); }
 
   /// Get error message text.
   /// @returns an error message for the current error state